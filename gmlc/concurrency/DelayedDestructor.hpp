@@ -9,9 +9,14 @@ All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 #ifdef ENABLE_TRIPWIRE
 #    include "TripWire.hpp"
 #endif
+#include "ParallelChunks.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -22,15 +27,247 @@ All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 #include <vector>
 
 namespace gmlc::concurrency {
+/** snapshot of the activity of a DelayedDestructor
+@details the sweep values cover the calls to destroyObjects, the pending age
+histogram is computed during each sweep so reflects the state as of the most
+recent sweep*/
+struct DelayedDestructorStatistics {
+    static constexpr std::size_t ageBucketCount{6};
+    /// upper limits of the age histogram buckets, the last bucket holds
+    /// anything older
+    static constexpr std::array<std::chrono::milliseconds, ageBucketCount - 1>
+        ageBucketLimits{std::chrono::milliseconds(1),
+                        std::chrono::milliseconds(10),
+                        std::chrono::milliseconds(100),
+                        std::chrono::milliseconds(1000),
+                        std::chrono::milliseconds(10000)};
+    std::uint64_t enqueued{0};  //!< objects added to the destructor
+    std::uint64_t destroyed{0};  //!< objects released by the destructor
+    /// the number of times a pending object was still referenced in a sweep
+    std::uint64_t skipped{0};
+    std::uint64_t sweeps{0};  //!< the number of completed sweeps
+    std::chrono::nanoseconds lastSweepDuration{0};
+    std::chrono::nanoseconds maxSweepDuration{0};
+    std::chrono::nanoseconds totalSweepDuration{0};
+    std::chrono::nanoseconds lastLockHoldTime{0};
+    std::chrono::nanoseconds maxLockHoldTime{0};
+    std::chrono::nanoseconds totalLockHoldTime{0};
+    /// time since addObjectsToBeDestroyed for the objects left after a sweep
+    std::array<std::uint64_t, ageBucketCount> pendingAgeHistogram{};
+    /// the number of objects added but not yet destroyed
+    std::uint64_t pending() const
+    {
+        return (enqueued > destroyed) ? enqueued - destroyed : 0;
+    }
+};
+
+namespace detail {
+    /** multi-producer single-consumer queue used to hand objects to a
+    destructor without taking its lock
+    @details push is wait-free (a single atomic exchange), pop may only be
+    called by one thread at a time.  This is the intrusive queue algorithm by
+    Dmitry Vyukov with a stub node*/
+    template<class T>
+    class MpscQueue {
+      private:
+        struct Node {
+            std::atomic<Node*> next{nullptr};
+            T value{};
+        };
+        std::atomic<Node*> head;
+        Node* tail;
+        Node stub;
+
+      public:
+        MpscQueue(): head(&stub), tail(&stub) {}
+        ~MpscQueue()
+        {
+            T value;
+            while (pop(value)) {
+            }
+        }
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        /** add a value to the queue, safe to call from any thread*/
+        void push(T value)
+        {
+            auto* node = new Node;
+            node->value = std::move(value);
+            pushNode(node);
+        }
+        /** take the oldest value out of the queue
+        @return false if the queue was empty or the next push has not
+        completed yet*/
+        bool pop(T& value)
+        {
+            Node* current = tail;
+            Node* next = current->next.load(std::memory_order_acquire);
+            if (current == &stub) {
+                if (next == nullptr) {
+                    return false;
+                }
+                tail = next;
+                current = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next == nullptr) {
+                if (current != head.load(std::memory_order_acquire)) {
+                    // a push is in progress
+                    return false;
+                }
+                pushNode(&stub);
+                next = current->next.load(std::memory_order_acquire);
+                if (next == nullptr) {
+                    return false;
+                }
+            }
+            tail = next;
+            value = std::move(current->value);
+            delete current;
+            return true;
+        }
+      private:
+        void pushNode(Node* node)
+        {
+            node->next.store(nullptr, std::memory_order_relaxed);
+            Node* prev = head.exchange(node, std::memory_order_acq_rel);
+            prev->next.store(node, std::memory_order_release);
+        }
+    };
+
+    /** lock free counters backing the DelayedDestructorStatistics
+    @details the counters are only updated with relaxed atomic operations so
+    a snapshot can be taken from any thread without blocking a sweep*/
+    class DestructorCounters {
+      public:
+        using clock = std::chrono::steady_clock;
+        std::atomic<std::uint64_t> enqueued{0};
+        std::atomic<std::uint64_t> destroyed{0};
+        std::atomic<std::uint64_t> skipped{0};
+
+        /// record the timing of a completed sweep
+        void recordSweep(clock::duration sweep, clock::duration lockHold)
+        {
+            auto sweepTime =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(sweep)
+                    .count();
+            auto lockTime =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(lockHold)
+                    .count();
+            sweeps.fetch_add(1, std::memory_order_relaxed);
+            lastSweep.store(sweepTime, std::memory_order_relaxed);
+            totalSweep.fetch_add(sweepTime, std::memory_order_relaxed);
+            updateMax(maxSweep, sweepTime);
+            lastLockHold.store(lockTime, std::memory_order_relaxed);
+            totalLockHold.fetch_add(lockTime, std::memory_order_relaxed);
+            updateMax(maxLockHold, lockTime);
+        }
+        /// publish the age histogram computed during a sweep
+        void recordAges(const std::array<std::uint64_t,
+                                         DelayedDestructorStatistics::
+                                             ageBucketCount>& histogram)
+        {
+            for (std::size_t ii = 0; ii < histogram.size(); ++ii) {
+                ageHistogram[ii].store(histogram[ii],
+                                       std::memory_order_relaxed);
+            }
+        }
+        /// get the histogram bucket for an object of a particular age
+        static std::size_t ageBucket(clock::duration age)
+        {
+            const auto& limits = DelayedDestructorStatistics::ageBucketLimits;
+            std::size_t bucket{0};
+            while (bucket < limits.size() && age >= limits[bucket]) {
+                ++bucket;
+            }
+            return bucket;
+        }
+        DelayedDestructorStatistics snapshot() const
+        {
+            DelayedDestructorStatistics stats;
+            // objects are counted as enqueued before they are staged and
+            // destroyed is released after, so reading destroyed first with
+            // acquire means enqueued is never behind it
+            stats.destroyed = destroyed.load(std::memory_order_acquire);
+            stats.enqueued = enqueued.load(std::memory_order_acquire);
+            stats.skipped = skipped.load(std::memory_order_relaxed);
+            stats.sweeps = sweeps.load(std::memory_order_relaxed);
+            stats.lastSweepDuration = std::chrono::nanoseconds(
+                lastSweep.load(std::memory_order_relaxed));
+            stats.maxSweepDuration = std::chrono::nanoseconds(
+                maxSweep.load(std::memory_order_relaxed));
+            stats.totalSweepDuration = std::chrono::nanoseconds(
+                totalSweep.load(std::memory_order_relaxed));
+            stats.lastLockHoldTime = std::chrono::nanoseconds(
+                lastLockHold.load(std::memory_order_relaxed));
+            stats.maxLockHoldTime = std::chrono::nanoseconds(
+                maxLockHold.load(std::memory_order_relaxed));
+            stats.totalLockHoldTime = std::chrono::nanoseconds(
+                totalLockHold.load(std::memory_order_relaxed));
+            for (std::size_t ii = 0; ii < ageHistogram.size(); ++ii) {
+                stats.pendingAgeHistogram[ii] =
+                    ageHistogram[ii].load(std::memory_order_relaxed);
+            }
+            return stats;
+        }
+
+      private:
+        static void updateMax(std::atomic<std::int64_t>& target,
+                              std::int64_t value)
+        {
+            auto current = target.load(std::memory_order_relaxed);
+            while (value > current &&
+                   !target.compare_exchange_weak(current,
+                                                 value,
+                                                 std::memory_order_relaxed)) {
+            }
+        }
+        std::atomic<std::uint64_t> sweeps{0};
+        std::atomic<std::int64_t> lastSweep{0};
+        std::atomic<std::int64_t> maxSweep{0};
+        std::atomic<std::int64_t> totalSweep{0};
+        std::atomic<std::int64_t> lastLockHold{0};
+        std::atomic<std::int64_t> maxLockHold{0};
+        std::atomic<std::int64_t> totalLockHold{0};
+        std::array<std::atomic<std::uint64_t>,
+                   DelayedDestructorStatistics::ageBucketCount>
+            ageHistogram{};
+    };
+}  // namespace detail
+
 /** helper class to destroy objects at a late time when it is convenient and
 * there are no more possibilities of threading issues
 @details this is essentially a delayed garbage collector based on shared_ptrs*/
 template<class X>
 class DelayedDestructor {
+  public:
+    /// callable used to run destruction tasks on another thread
+    using Executor = std::function<void(std::function<void()>)>;
+
   private:
+    using clock = std::chrono::steady_clock;
+    struct PendingObject {
+        std::shared_ptr<X> object;
+        clock::time_point added;  //!< when the object was added
+    };
     std::timed_mutex destructionLock;
-    std::vector<std::shared_ptr<X>> ElementsToBeDestroyed;
+    std::vector<PendingObject> ElementsToBeDestroyed;
+    /// objects added but not yet moved into ElementsToBeDestroyed
+    detail::MpscQueue<PendingObject> stagedElements;
+    detail::DestructorCounters counters;
     std::function<void(std::shared_ptr<X>& ptr)> callBeforeDeleteFunction;
+    /// batches at least this large are destroyed in parallel (0 disables)
+    std::size_t parallelBatchSize{0};
+    std::size_t parallelThreadCount{1};
+    Executor parallelExecutor;
+    std::thread reaperThread;  //!< background thread running the sweeps
+    std::mutex reaperLock;  //!< mutex protecting the reaper state
+    std::condition_variable reaperCondition;  //!< wakes the reaper thread
+    std::chrono::milliseconds reaperInterval{100};
+    std::atomic<bool> reaperActive{false};
+    std::atomic<bool> reaperWake{false};
+    bool reaperStop{false};
 #ifdef ENABLE_TRIPWIRE
     TripWireDetector tripDetect;
 #endif
@@ -45,6 +282,11 @@ class DelayedDestructor {
     ~DelayedDestructor()
     {
         try {
+            stopReaper();
+            {
+                std::lock_guard<std::timed_mutex> lock(destructionLock);
+                drainStagedElements();
+            }
             int ii = 0;
             while (!ElementsToBeDestroyed.empty()) {
                 ++ii;
@@ -81,51 +323,53 @@ class DelayedDestructor {
         std::size_t elementSize{static_cast<std::size_t>(-1)};
         std::chrono::milliseconds wait(std::chrono::milliseconds(200));
         try {
+            const auto sweepStart = clock::now();
             std::unique_lock<std::timed_mutex> lock(destructionLock,
                                                     std::defer_lock);
             if (!lock.try_lock_for(wait)) {
                 return elementSize;
             }
+            const auto lockStart = clock::now();
+            drainStagedElements();
             elementSize = ElementsToBeDestroyed.size();
-            if (elementSize > 0) {
-                std::vector<std::shared_ptr<X>> ecall;
-                std::vector<void*> epointers;
-                for (auto& element : ElementsToBeDestroyed) {
-                    if (element.use_count() == 1) {
-                        ecall.push_back(element);
-                        epointers.emplace_back(element.get());
-                    }
-                }
-                if (!epointers.empty()) {
-                    // so apparently remove_if can actually call the
-                    // destructor for shared_ptrs so the call function needs
-                    // to be before this call
-                    auto loc =
-                        std::remove_if(ElementsToBeDestroyed.begin(),
-                                       ElementsToBeDestroyed.end(),
-                                       [&epointers](const auto& element) {
-                                           return (
-                                               (element.use_count() == 2) &&
-                                               (std::find(epointers.begin(),
-                                                          epointers.end(),
-                                                          static_cast<void*>(
-                                                              element.get())) !=
-                                                epointers.end()));
-                                       });
-                    ElementsToBeDestroyed.erase(loc,
-                                                ElementsToBeDestroyed.end());
+            if (elementSize == 0) {
+                counters.recordAges({});
+                counters.recordSweep(clock::now() - sweepStart,
+                                     clock::now() - lockStart);
+            } else {
+                auto ecall = extractReadyElements(elementSize,
+                                                  clock::time_point::max());
+                auto lockEnd = clock::now();
+                if (ecall.empty()) {
+                    counters.recordSweep(lockEnd - sweepStart,
+                                         lockEnd - lockStart);
+                } else {
                     elementSize = ElementsToBeDestroyed.size();
                     auto deleteFunc = callBeforeDeleteFunction;
+                    const bool parallel = (parallelBatchSize > 0 &&
+                                           ecall.size() >= parallelBatchSize);
+                    auto threadCount = parallelThreadCount;
+                    auto executor = parallelExecutor;
                     lock.unlock();
+                    lockEnd = clock::now();
                     // this needs to be done after the lock, so a destructor
                     // can never called while under the lock
-                    if (deleteFunc) {
+                    if (parallel) {
+                        destroyInParallel(
+                            ecall, deleteFunc, threadCount, executor);
+                    } else {
                         for (auto& element : ecall) {
-                            deleteFunc(element);
+                            if (deleteFunc) {
+                                deleteFunc(element.object);
+                            }
+                            element.object.reset();
                         }
                     }
-                    ecall.clear();  // make sure the destructors get called
-                                    // before returning.
+                    counters.destroyed.fetch_add(ecall.size(),
+                                                 std::memory_order_release);
+                    ecall.clear();
+                    counters.recordSweep(clock::now() - sweepStart,
+                                         lockEnd - lockStart);
                     // reengage the lock so the size is correct
                     if (!lock.try_lock_for(wait)) {
                         return elementSize;
@@ -153,6 +397,7 @@ class DelayedDestructor {
             (delay < 100ms) ? 1 : static_cast<int>((delay.count() / 50));
 
         int cnt = 0;
+        drainStagedElements();
         auto elementSize = ElementsToBeDestroyed.size();
         while (elementSize > 0 && (cnt < delayCount)) {
             if (cnt > 0)  // don't sleep on the first loop
@@ -177,29 +422,298 @@ class DelayedDestructor {
         }
         return ElementsToBeDestroyed.size();
     }
+    /** destroy objects that are no longer used while staying within a budget
+    @details the sweep stops once maxObjects have been destroyed or the
+    timeBudget has expired, the remaining objects are left for the next call.
+    Once the lock is acquired at least one ready object is destroyed so
+    progress is always made even with a very small timeBudget
+    @param timeBudget the maximum amount of time to spend in the call
+    @param maxObjects the maximum number of objects to destroy
+    @return the number of objects still waiting to be destroyed or (size_t)-1
+    if the lock could not be acquired within the budget*/
+    size_t destroyObjects(std::chrono::microseconds timeBudget,
+                          std::size_t maxObjects) noexcept
+    {
+        std::size_t elementSize{static_cast<std::size_t>(-1)};
+        try {
+            const auto sweepStart = clock::now();
+            const auto deadline = sweepStart + timeBudget;
+            std::unique_lock<std::timed_mutex> lock(destructionLock,
+                                                    std::defer_lock);
+            if (!lock.try_lock_until(deadline)) {
+                return elementSize;
+            }
+            const auto lockStart = clock::now();
+            drainStagedElements();
+            auto ecall = extractReadyElements(maxObjects, deadline);
+            elementSize = ElementsToBeDestroyed.size();
+            if (ecall.empty()) {
+                auto lockEnd = clock::now();
+                counters.recordSweep(lockEnd - sweepStart,
+                                     lockEnd - lockStart);
+                return elementSize;
+            }
+            auto deleteFunc = callBeforeDeleteFunction;
+            lock.unlock();
+            const auto lockEnd = clock::now();
+            std::size_t index{0};
+            while (index < ecall.size()) {
+                if (deleteFunc) {
+                    deleteFunc(ecall[index].object);
+                }
+                ecall[index].object.reset();
+                ++index;
+                if (clock::now() >= deadline) {
+                    break;
+                }
+            }
+            counters.destroyed.fetch_add(index, std::memory_order_release);
+            counters.recordSweep(clock::now() - sweepStart,
+                                 lockEnd - lockStart);
+            // return anything that didn't fit in the budget through the
+            // staging queue so the call never blocks behind another sweep
+            elementSize += ecall.size() - index;
+            while (index < ecall.size()) {
+                stagedElements.push(std::move(ecall[index]));
+                ++index;
+            }
+        }
+        catch (...) {
+        }
+        return elementSize;
+    }
+
+    /** destroy large batches of ready objects in parallel
+    @details when destroyObjects finds at least minBatchSize ready objects the
+    batch is split into chunks, the callBeforeDeleteFunction and destructors
+    of each chunk are run on a separate thread and the call returns once all
+    chunks are complete.  Smaller batches and the budgeted destroyObjects are
+    always handled on the calling thread
+    @param minBatchSize the smallest batch to split, 0 disables parallel
+    destruction
+    @param threadCount the number of chunks to split a batch into, one of
+    which is run on the calling thread
+    @param executor optional callable used to run the chunks, if empty the
+    chunks run on a pool of threadCount-1 threads created here and kept until
+    the destructor is destroyed or this is called again*/
+    void setParallelDestruction(std::size_t minBatchSize,
+                                std::size_t threadCount,
+                                Executor executor = nullptr)
+    {
+        threadCount = (threadCount > 0) ? threadCount : 1;
+        if (!executor && minBatchSize > 0 && threadCount > 1) {
+            executor = detail::makePoolExecutor(threadCount - 1);
+        }
+        std::lock_guard<std::timed_mutex> lock(destructionLock);
+        parallelBatchSize = minBatchSize;
+        parallelThreadCount = threadCount;
+        // a previous pool is joined once the lock is released
+        std::swap(parallelExecutor, executor);
+    }
+
+    /** get a snapshot of the activity counters
+    @details this only reads atomic counters so it can be called from a
+    metrics thread at any time without blocking or being blocked by a sweep*/
+    DelayedDestructorStatistics getStatistics() const
+    {
+        return counters.snapshot();
+    }
+
     /// @brief  get the number of elements waiting to be destroyed
     /// @return number of objects
     auto size()
     {
         std::lock_guard<std::timed_mutex> lock(destructionLock);
+        drainStagedElements();
         return ElementsToBeDestroyed.size();
     }
 
+    /** add an object to be destroyed
+    @details this does not acquire the destruction lock so it will not block
+    behind a sweep in progress, the object is staged and picked up by the next
+    sweep*/
     void addObjectsToBeDestroyed(std::shared_ptr<X> obj)
     {
-        std::lock_guard<std::timed_mutex> lock(destructionLock);
-        ElementsToBeDestroyed.push_back(std::move(obj));
+        counters.enqueued.fetch_add(1, std::memory_order_release);
+        stagedElements.push(PendingObject{std::move(obj), clock::now()});
+        if (reaperActive.load(std::memory_order_acquire) &&
+            !reaperWake.exchange(true)) {
+            std::lock_guard<std::mutex> lock(reaperLock);
+            reaperCondition.notify_one();
+        }
+    }
+
+    /** start a background thread that runs the sweeps
+    @details the reaper thread wakes whenever objects are added or the
+    interval expires and calls destroyObjects, so the callBeforeDeleteFunction
+    and the destructors are executed on the reaper thread instead of the
+    callers thread
+    @param interval the maximum time between sweeps
+    @return true if the reaper was started, false if it was already running*/
+    bool startReaper(
+        std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+    {
+        std::lock_guard<std::mutex> lock(reaperLock);
+        if (reaperThread.joinable()) {
+            return false;
+        }
+        reaperInterval = interval;
+        reaperStop = false;
+        reaperWake.store(false);
+        reaperThread = std::thread([this]() { reaperLoop(); });
+        reaperActive.store(true, std::memory_order_release);
+        return true;
+    }
+    /** stop the background reaper thread
+    @details any sweep in progress is completed before returning, objects that
+    are still in use remain in the destructor and will be handled by the next
+    call to destroyObjects or by the destructor*/
+    void stopReaper()
+    {
+        std::thread reaper;
+        {
+            std::lock_guard<std::mutex> lock(reaperLock);
+            if (!reaperThread.joinable()) {
+                return;
+            }
+            reaperActive.store(false, std::memory_order_release);
+            reaperStop = true;
+            reaperCondition.notify_one();
+            reaper = std::move(reaperThread);
+        }
+        if (reaper.get_id() == std::this_thread::get_id()) {
+            // stopped from a callback running on the reaper itself
+            reaper.detach();
+        } else {
+            reaper.join();
+        }
+    }
+    /// @brief check if the background reaper thread is running
+    bool isReaperRunning() const
+    {
+        return reaperActive.load(std::memory_order_acquire);
+    }
+
+  private:
+    /// move the staged objects into the main list, must be called under the
+    /// destructionLock
+    void drainStagedElements()
+    {
+        PendingObject obj;
+        while (stagedElements.pop(obj)) {
+            ElementsToBeDestroyed.push_back(std::move(obj));
+        }
+    }
+
+    /** remove up to maxObjects elements that are only referenced by the
+    destructor, must be called under the destructionLock
+    @details the scan stops early if the deadline passes, the order of the
+    remaining elements is preserved.  The skipped count and age histogram are
+    updated as part of the scan*/
+    std::vector<PendingObject>
+        extractReadyElements(std::size_t maxObjects,
+                             clock::time_point deadline)
+    {
+        constexpr std::size_t timeCheckInterval{256};
+        std::vector<PendingObject> ready;
+        std::array<std::uint64_t, DelayedDestructorStatistics::ageBucketCount>
+            ages{};
+        const auto now = clock::now();
+        std::uint64_t skipped{0};
+        std::size_t keep{0};
+        const std::size_t total = ElementsToBeDestroyed.size();
+        for (std::size_t ii = 0; ii < total; ++ii) {
+            auto& element = ElementsToBeDestroyed[ii];
+            if (ready.size() < maxObjects && element.object.use_count() == 1) {
+                ready.push_back(std::move(element));
+            } else {
+                if (element.object.use_count() > 1) {
+                    ++skipped;
+                }
+                ++ages[detail::DestructorCounters::ageBucket(now -
+                                                             element.added)];
+                // the target slot is always empty so this never triggers a
+                // destructor while under the lock
+                if (keep != ii) {
+                    ElementsToBeDestroyed[keep] = std::move(element);
+                }
+                ++keep;
+            }
+            if (ii % timeCheckInterval == timeCheckInterval - 1 &&
+                std::chrono::steady_clock::now() >= deadline) {
+                for (++ii; ii < total; ++ii) {
+                    ++ages[detail::DestructorCounters::ageBucket(
+                        now - ElementsToBeDestroyed[ii].added)];
+                    if (keep != ii) {
+                        ElementsToBeDestroyed[keep] =
+                            std::move(ElementsToBeDestroyed[ii]);
+                    }
+                    ++keep;
+                }
+                break;
+            }
+        }
+        ElementsToBeDestroyed.resize(keep);
+        counters.skipped.fetch_add(skipped, std::memory_order_relaxed);
+        counters.recordAges(ages);
+        return ready;
+    }
+
+    /// run the delete function and destructors for a batch in parallel
+    /// chunks, must not be called under the destructionLock
+    static void destroyInParallel(
+        std::vector<PendingObject>& batch,
+        const std::function<void(std::shared_ptr<X>& ptr)>& deleteFunc,
+        std::size_t threadCount,
+        const Executor& executor)
+    {
+        auto destroyChunk = [&batch, &deleteFunc](std::size_t first,
+                                                  std::size_t last) {
+            for (std::size_t ii = first; ii < last; ++ii) {
+                try {
+                    if (deleteFunc) {
+                        deleteFunc(batch[ii].object);
+                    }
+                    batch[ii].object.reset();
+                }
+                catch (...) {
+                }
+            }
+        };
+        detail::runInChunks(batch.size(), threadCount, executor, destroyChunk);
+    }
+
+    void reaperLoop()
+    {
+        std::unique_lock<std::mutex> lock(reaperLock);
+        while (!reaperStop) {
+            reaperCondition.wait_for(lock, reaperInterval, [this]() {
+                return reaperStop || reaperWake.load();
+            });
+            if (reaperStop) {
+                break;
+            }
+            reaperWake.store(false);
+            lock.unlock();
+            destroyObjects();
+            lock.lock();
+        }
     }
 };
 
 /// @brief  handle the delayed destructor as a single thread so no locks,
-/// possible use with thread local structure
+/// possible use with thread local structure.  Other threads can send objects
+/// to the owning thread through a wait-free inbox (handOffObject) which is
+/// drained by destroyObjects
 /// @tparam X the class of object to be destroyed
 template<class X>
 class DelayedDestructorSingleThread {
   private:
     std::vector<std::shared_ptr<X>> ElementsToBeDestroyed;
+    /// objects handed over from other threads
+    detail::MpscQueue<std::shared_ptr<X>> inbox;
     std::function<void(std::shared_ptr<X>& ptr)> callBeforeDeleteFunction;
+    std::thread::id ownerThread{std::this_thread::get_id()};
 #ifdef ENABLE_TRIPWIRE
     TripWireDetector tripDetect;
 #endif
@@ -214,6 +728,7 @@ class DelayedDestructorSingleThread {
     ~DelayedDestructorSingleThread()
     {
         try {
+            drainInbox();
             int ii = 0;
             while (!ElementsToBeDestroyed.empty()) {
                 ++ii;
@@ -251,6 +766,7 @@ class DelayedDestructorSingleThread {
     {
         std::size_t elementSize{static_cast<std::size_t>(-1)};
         try {
+            drainInbox();
             elementSize = ElementsToBeDestroyed.size();
             if (elementSize > 0) {
                 std::vector<std::shared_ptr<X>> ecall;
@@ -309,6 +825,7 @@ class DelayedDestructorSingleThread {
             (delay < 100ms) ? 1 : static_cast<int>((delay.count() / 50));
 
         int cnt = 0;
+        drainInbox();
         auto elementSize = ElementsToBeDestroyed.size();
         while (elementSize > 0 && (cnt < delayCount)) {
             if (cnt > 0)  // don't sleep on the first loop
@@ -328,11 +845,44 @@ class DelayedDestructorSingleThread {
 
     /// @brief  get the number of elements waiting to be destroyed
     /// @return number of objects
-    auto size() { return ElementsToBeDestroyed.size(); }
+    auto size()
+    {
+        drainInbox();
+        return ElementsToBeDestroyed.size();
+    }
 
+    /** add an object to be destroyed
+    @details calls from the owning thread go directly into the local list,
+    calls from any other thread are routed through handOffObject*/
     void addObjectsToBeDestroyed(std::shared_ptr<X> obj)
     {
-        ElementsToBeDestroyed.push_back(std::move(obj));
+        if (std::this_thread::get_id() == ownerThread) {
+            ElementsToBeDestroyed.push_back(std::move(obj));
+        } else {
+            handOffObject(std::move(obj));
+        }
+    }
+
+    /** send an object from another thread to be destroyed on the owning
+    thread
+    @details this is safe to call from any thread and is wait-free, the
+    object is moved into the local list by the next call to destroyObjects
+    or size on the owning thread*/
+    void handOffObject(std::shared_ptr<X> obj) { inbox.push(std::move(obj)); }
+
+    /** make the calling thread the owner of the destructor
+    @details the owner is initially the constructing thread, this should be
+    called before the destructor is shared with other threads*/
+    void bindToCurrentThread() { ownerThread = std::this_thread::get_id(); }
+
+  private:
+    /// move objects handed over by other threads into the local list
+    void drainInbox()
+    {
+        std::shared_ptr<X> obj;
+        while (inbox.pop(obj)) {
+            ElementsToBeDestroyed.push_back(std::move(obj));
+        }
     }
 };
 
@@ -6,184 +6,1521 @@ All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 */
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <list>
 #include <future>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace gmlc::concurrency {
-/** class holding a set of delayed objects, the delayed object are held by
- * promises*/
+namespace detail {
+    /** table of values indexed by integer keys
+    @details keys within a window are stored in a ring buffer indexed directly
+    by the key so lookups are O(1) and slots are recycled as the window moves,
+    keys that would stretch the window too far fall back to a hash map.  This
+    suits keys that are mostly increasing such as request ids.  A table can
+    be limited to the keys with a particular residue modulo a stride, in which
+    case consecutive keys of that residue occupy consecutive slots*/
+    template<class T>
+    class IndexedSlotTable {
+      public:
+        /// the largest number of consecutive keys held in the ring buffer
+        static constexpr std::size_t maxWindow{65536};
+
+        IndexedSlotTable() = default;
+        /** construct a table for keys where key % keyStride == keyResidue
+        @details keys outside that set must not be used with the table*/
+        IndexedSlotTable(int keyStride, int keyResidue):
+            stride(keyStride), residue(keyResidue)
+        {
+        }
+
+        /// get the value for a key or nullptr if not present
+        T* find(int key)
+        {
+            if (count > 0) {
+                const auto offset = slotIndex(key) - base;
+                if (offset >= 0 && offset < static_cast<std::int64_t>(count)) {
+                    auto& slot = ring[position(offset)];
+                    if (slot) {
+                        return &(*slot);
+                    }
+                }
+            }
+            if (!sparse.empty()) {
+                auto fnd = sparse.find(key);
+                if (fnd != sparse.end()) {
+                    return &(fnd->second);
+                }
+            }
+            return nullptr;
+        }
+        /** get the value for a key, creating a default value if needed
+        @return a pointer to the value and true if it was created*/
+        std::pair<T*, bool> emplace(int key)
+        {
+            if (auto* existing = find(key)) {
+                return {existing, false};
+            }
+            const auto ikey = slotIndex(key);
+            if (count == 0) {
+                reserve(1);
+                base = ikey;
+                count = 1;
+                return {emplaceSlot(0), true};
+            }
+            const auto offset = ikey - base;
+            if (offset >= 0) {
+                const auto newCount = static_cast<std::size_t>(offset) + 1;
+                if (newCount <= maxWindow) {
+                    if (newCount > count) {
+                        reserve(newCount);
+                        count = newCount;
+                    }
+                    return {emplaceSlot(static_cast<std::size_t>(offset)),
+                            true};
+                }
+            } else {
+                const auto shift = static_cast<std::size_t>(-offset);
+                if (count + shift <= maxWindow) {
+                    reserve(count + shift);
+                    head = (head + ring.size() - shift) & (ring.size() - 1);
+                    base = ikey;
+                    count += shift;
+                    return {emplaceSlot(0), true};
+                }
+            }
+            return {&(sparse.emplace(key, T{}).first->second), true};
+        }
+        /// remove a key from the table
+        bool erase(int key)
+        {
+            if (count > 0) {
+                const auto offset = slotIndex(key) - base;
+                if (offset >= 0 && offset < static_cast<std::int64_t>(count)) {
+                    auto& slot = ring[position(offset)];
+                    if (slot) {
+                        slot.reset();
+                        --used;
+                        trim();
+                        return true;
+                    }
+                }
+            }
+            return (sparse.erase(key) > 0);
+        }
+        /// call func(key, value) for every value in the table
+        template<class Func>
+        void forEach(Func&& func)
+        {
+            for (std::size_t ii = 0; ii < count; ++ii) {
+                auto& slot = ring[position(ii)];
+                if (slot) {
+                    const auto index = base + static_cast<std::int64_t>(ii);
+                    func(static_cast<int>(index * stride + residue), *slot);
+                }
+            }
+            for (auto& element : sparse) {
+                func(element.first, element.second);
+            }
+        }
+        /// the number of values in the table
+        std::size_t size() const { return used + sparse.size(); }
+        bool empty() const { return size() == 0; }
+
+      private:
+        /// the dense index of a key within the keys used by the table
+        std::int64_t slotIndex(int key) const
+        {
+            return (static_cast<std::int64_t>(key) - residue) / stride;
+        }
+        std::size_t position(std::int64_t offset) const
+        {
+            return (head + static_cast<std::size_t>(offset)) &
+                (ring.size() - 1);
+        }
+        T* emplaceSlot(std::size_t offset)
+        {
+            ++used;
+            return &ring[position(static_cast<std::int64_t>(offset))]
+                        .emplace();
+        }
+        /// make sure the ring can hold a window of the given size, the ring
+        /// size is kept at a power of 2
+        void reserve(std::size_t windowSize)
+        {
+            if (windowSize <= ring.size()) {
+                return;
+            }
+            std::size_t newSize = (ring.empty()) ? 16 : ring.size();
+            while (newSize < windowSize) {
+                newSize *= 2;
+            }
+            std::vector<std::optional<T>> newRing(newSize);
+            for (std::size_t ii = 0; ii < count; ++ii) {
+                newRing[ii] = std::move(ring[position(ii)]);
+            }
+            ring = std::move(newRing);
+            head = 0;
+        }
+        /// advance the window past empty slots at either end
+        void trim()
+        {
+            while (count > 0 && !ring[head]) {
+                head = (head + 1) & (ring.size() - 1);
+                ++base;
+                --count;
+            }
+            while (count > 0 && !ring[position(count - 1)]) {
+                --count;
+            }
+        }
+
+        std::vector<std::optional<T>> ring;
+        std::size_t head{0};  //!< ring position of the first key in the window
+        std::size_t count{0};  //!< the number of keys in the window
+        std::int64_t base{0};  //!< the first key in the window
+        std::size_t used{0};  //!< the number of occupied ring slots
+        std::int64_t stride{1};
+        std::int64_t residue{0};
+        std::unordered_map<int, T> sparse;
+    };
+
+    /** table of values indexed by an ordered key with the same interface
+    as the IndexedSlotTable
+    @details the comparison is transparent so lookups can use any type
+    comparable with the key without constructing a key*/
+    template<class Key, class T>
+    class OrderedSlotTable {
+      public:
+        /// get the value for a key or nullptr if not present
+        template<class K>
+        T* find(const K& key)
+        {
+            auto fnd = table.find(key);
+            return (fnd != table.end()) ? &(fnd->second) : nullptr;
+        }
+        /** get the value for a key, creating a default value if needed
+        @return a pointer to the value and true if it was created*/
+        template<class K>
+        std::pair<T*, bool> emplace(const K& key)
+        {
+            auto fnd = table.lower_bound(key);
+            if (fnd != table.end() && !table.key_comp()(key, fnd->first)) {
+                return {&(fnd->second), false};
+            }
+            // a key is only constructed when a new value is inserted
+            fnd = table.emplace_hint(fnd,
+                                     std::piecewise_construct,
+                                     std::forward_as_tuple(key),
+                                     std::forward_as_tuple());
+            return {&(fnd->second), true};
+        }
+        /// remove a key from the table
+        template<class K>
+        bool erase(const K& key)
+        {
+            auto fnd = table.find(key);
+            if (fnd == table.end()) {
+                return false;
+            }
+            table.erase(fnd);
+            return true;
+        }
+        /// call func(key, value) for every value in the table
+        template<class Func>
+        void forEach(Func&& func)
+        {
+            for (auto& element : table) {
+                func(element.first, element.second);
+            }
+        }
+        /// the number of values in the table
+        std::size_t size() const { return table.size(); }
+        bool empty() const { return table.empty(); }
+
+      private:
+        std::map<Key, T, std::less<>> table;
+    };
+
+    /// queue of completed keys shared between a waiter and the entries it
+    /// watches
+    template<class Key>
+    class CompletionWatcher {
+      public:
+        /// push the key of an entry that was already complete when watched
+        void push(Key key)
+        {
+            {
+                std::lock_guard<std::mutex> lock(queueLock);
+                completed.push_back(std::move(key));
+            }
+            condition.notify_all();
+        }
+        /// note a watched entry that has not completed yet
+        void expect()
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            ++outstanding;
+        }
+        /// push the key of a watched entry that has completed
+        void complete(Key key)
+        {
+            {
+                std::lock_guard<std::mutex> lock(queueLock);
+                if (outstanding > 0) {
+                    --outstanding;
+                }
+                completed.push_back(std::move(key));
+            }
+            condition.notify_all();
+        }
+        std::optional<Key> tryPop()
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            return popFront();
+        }
+        template<class Rep, class Period>
+        std::optional<Key>
+            pop(const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+            condition.wait_for(lock, timeout, [this]() {
+                return !completed.empty() || outstanding == 0;
+            });
+            return popFront();
+        }
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            return completed.size();
+        }
+
+      private:
+        std::optional<Key> popFront()
+        {
+            if (completed.empty()) {
+                return std::nullopt;
+            }
+            std::optional<Key> key(std::move(completed.front()));
+            completed.pop_front();
+            return key;
+        }
+        mutable std::mutex queueLock;
+        std::condition_variable condition;
+        std::deque<Key> completed;
+        std::size_t outstanding{0};  //!< watched keys not yet completed
+    };
+
+    template<class X>
+    class OneShotPool;
+    template<class X>
+    class OneShotFreeList;
+
+    /** storage for a single value delivered once from one thread to another
+    @details the state is shared between the DelayedObjects entry and a
+    OneShotFuture, whichever releases it last returns it to the free list of
+    the pool it came from for reuse*/
+    template<class X>
+    class OneShotState {
+      public:
+        /// check if the value has been set
+        bool ready() const { return isReady.load(); }
+        /// set the value and wake any waiting thread
+        template<class V>
+        void set(V&& val)
+        {
+            storage.emplace(std::forward<V>(val));
+            isReady.store(true);
+            if (parked.load()) {
+                std::lock_guard<std::mutex> lock(parkLock);
+                parkCondition.notify_all();
+            }
+        }
+        /// wait for the value, spinning briefly before blocking
+        void wait()
+        {
+            if (spinWait()) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(parkLock);
+            parked.store(true);
+            parkCondition.wait(lock, [this]() { return ready(); });
+        }
+        /// wait for a period of time for the value
+        template<class Rep, class Period>
+        bool wait_for(const std::chrono::duration<Rep, Period>& duration)
+        {
+            if (spinWait()) {
+                return true;
+            }
+            std::unique_lock<std::mutex> lock(parkLock);
+            parked.store(true);
+            return parkCondition.wait_for(lock, duration, [this]() {
+                return ready();
+            });
+        }
+        const X& value() const { return *storage; }
+        /// release a reference held by an entry or a OneShotFuture
+        void release()
+        {
+            if (references.fetch_sub(1) == 1) {
+                // the free list may go away with the last reference to it
+                auto owner = std::move(freeList);
+                reset();
+                owner->recycle(this);
+            }
+        }
+
+      private:
+        friend class OneShotPool<X>;
+        bool spinWait() const
+        {
+            constexpr int spinCount{64};
+            constexpr int yieldCount{16};
+            for (int ii = 0; ii < spinCount + yieldCount; ++ii) {
+                if (ready()) {
+                    return true;
+                }
+                if (ii >= spinCount) {
+                    std::this_thread::yield();
+                }
+            }
+            return ready();
+        }
+        void reset()
+        {
+            storage.reset();
+            isReady.store(false);
+            parked.store(false);
+        }
+        std::optional<X> storage;
+        std::atomic<bool> isReady{false};
+        std::atomic<bool> parked{false};
+        std::atomic<int> references{0};
+        std::mutex parkLock;
+        std::condition_variable parkCondition;
+        /// set while the state is in use
+        std::shared_ptr<OneShotFreeList<X>> freeList;
+    };
+
+    /** the unused states of a OneShotPool
+    @details the states in use share ownership of the free list so it
+    remains available to them if the pool is destroyed first*/
+    template<class X>
+    class OneShotFreeList {
+      public:
+        OneShotFreeList() = default;
+        OneShotFreeList(const OneShotFreeList&) = delete;
+        OneShotFreeList& operator=(const OneShotFreeList&) = delete;
+        ~OneShotFreeList()
+        {
+            for (auto* state : freeStates) {
+                delete state;
+            }
+        }
+        /// get an unused state or nullptr if there are none
+        OneShotState<X>* take()
+        {
+            std::lock_guard<std::mutex> lock(listLock);
+            if (freeStates.empty()) {
+                return nullptr;
+            }
+            auto* state = freeStates.back();
+            freeStates.pop_back();
+            return state;
+        }
+        void recycle(OneShotState<X>* state)
+        {
+            std::lock_guard<std::mutex> lock(listLock);
+            freeStates.push_back(state);
+        }
+
+      private:
+        std::mutex listLock;
+        std::vector<OneShotState<X>*> freeStates;
+    };
+
+    /** the reference to a OneShotState held by a DelayedObjects entry
+    @details if the reference is released before the value was set the state
+    is fulfilled with a default value so a waiting future does not block
+    forever*/
+    template<class X>
+    class OneShotReference {
+      public:
+        OneShotReference() = default;
+        explicit OneShotReference(OneShotState<X>* slot): state(slot) {}
+        OneShotReference(OneShotReference&& other) noexcept:
+            state(std::exchange(other.state, nullptr))
+        {
+        }
+        OneShotReference& operator=(OneShotReference&& other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                state = std::exchange(other.state, nullptr);
+            }
+            return *this;
+        }
+        ~OneShotReference() { reset(); }
+        explicit operator bool() const { return state != nullptr; }
+        OneShotState<X>* get() const { return state; }
+        template<class V>
+        void set(V&& val)
+        {
+            state->set(std::forward<V>(val));
+        }
+        void reset()
+        {
+            if (state != nullptr) {
+                if (!state->ready()) {
+                    state->set(X{});
+                }
+                state->release();
+                state = nullptr;
+            }
+        }
+
+      private:
+        OneShotState<X>* state{nullptr};
+    };
+
+    /// pool of reusable OneShotState objects
+    template<class X>
+    class OneShotPool {
+      public:
+        OneShotPool() = default;
+        OneShotPool(const OneShotPool&) = delete;
+        OneShotPool& operator=(const OneShotPool&) = delete;
+        /// get a state referenced by both an entry and a future
+        OneShotReference<X> acquire()
+        {
+            OneShotState<X>* state = freeList->take();
+            if (state == nullptr) {
+                state = new OneShotState<X>();
+            }
+            state->freeList = freeList;
+            state->references.store(2);
+            return OneShotReference<X>(state);
+        }
+
+      private:
+        std::shared_ptr<OneShotFreeList<X>> freeList{
+            std::make_shared<OneShotFreeList<X>>()};
+    };
+}  // namespace detail
+
+/** future like handle to a value held in a DelayedObjects slot
+@details the value is stored inline in a pooled slot so creating the handle
+does not allocate once the pool is warm, waiting spins briefly before parking
+on a condition variable.  The handle is movable but not copyable*/
 template<class X>
-class DelayedObjects {
+class OneShotFuture {
+  public:
+    OneShotFuture() = default;
+    explicit OneShotFuture(detail::OneShotState<X>* slot): state(slot) {}
+    OneShotFuture(OneShotFuture&& other) noexcept:
+        state(std::exchange(other.state, nullptr))
+    {
+    }
+    OneShotFuture& operator=(OneShotFuture&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            state = std::exchange(other.state, nullptr);
+        }
+        return *this;
+    }
+    OneShotFuture(const OneShotFuture&) = delete;
+    OneShotFuture& operator=(const OneShotFuture&) = delete;
+    ~OneShotFuture() { release(); }
+
+    /// check if the handle refers to a slot
+    bool valid() const { return state != nullptr; }
+    /// check if the value is available without waiting
+    bool is_ready() const { return state != nullptr && state->ready(); }
+    /// wait for the value to be available
+    void wait() const { state->wait(); }
+    /// wait for a period of time for the value to be available
+    template<class Rep, class Period>
+    std::future_status
+        wait_for(const std::chrono::duration<Rep, Period>& duration) const
+    {
+        return state->wait_for(duration) ? std::future_status::ready :
+                                           std::future_status::timeout;
+    }
+    /** wait for and get the value
+    @details the returned reference remains valid as long as the handle*/
+    const X& get() const
+    {
+        state->wait();
+        return state->value();
+    }
+
   private:
-    std::map<int, std::promise<X>> promiseByInteger;
-    std::map<std::string, std::promise<X>> promiseByString;
-    std::mutex promiseLock;
-    std::map<int, std::promise<X>> usedPromiseByInteger;
-    std::map<std::string, std::promise<X>> usedPromiseByString;
+    void release()
+    {
+        if (state != nullptr) {
+            state->release();
+            state = nullptr;
+        }
+    }
+    detail::OneShotState<X>* state{nullptr};
+};
+
+/** default hashing policy used to assign keys to shards in a
+DelayedObjectTable
+@details the policy is also applied to probe keys so it must give the same
+result for a probe as for the equivalent key*/
+template<class Key>
+struct DelayedKeyHash {
+    std::size_t operator()(const Key& key) const
+    {
+        return std::hash<Key>{}(key);
+    }
+};
 
+/// string keys are hashed through string_view so probes do not allocate
+template<>
+struct DelayedKeyHash<std::string> {
+    std::size_t operator()(std::string_view key) const
+    {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+/** queue receiving the keys of watched delayed objects as they complete
+@details keys are added to the queue with DelayedObjectTable::watchCompletions
+and can be drained in completion order by the owner of the queue.  Entries
+only hold a weak reference to the queue so it can be destroyed at any time*/
+template<class Key>
+class DelayedCompletionQueue {
   public:
-    DelayedObjects() = default;
+    DelayedCompletionQueue():
+        watcher(std::make_shared<detail::CompletionWatcher<Key>>())
+    {
+    }
+    DelayedCompletionQueue(const DelayedCompletionQueue&) = delete;
+    DelayedCompletionQueue& operator=(const DelayedCompletionQueue&) = delete;
+
+    /// get the next completed key if there is one
+    std::optional<Key> tryPop() { return watcher->tryPop(); }
+    /** wait for a period of time for the next completed key
+    @details this returns immediately if no watched key is still pending*/
+    template<class Rep, class Period>
+    std::optional<Key> pop(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        return watcher->pop(timeout);
+    }
+    /// get the number of completed keys in the queue
+    std::size_t size() const { return watcher->size(); }
+    bool empty() const { return size() == 0; }
+
+  private:
+    template<class, class, class>
+    friend class DelayedObjectTable;
+    std::shared_ptr<detail::CompletionWatcher<Key>> watcher;
+};
+
+/// the order completed entries are evicted in when over the retention limit
+enum class EvictionOrder {
+    fifo,  //!< evict the entries that completed first
+    lru  //!< evict the entries that were accessed least recently
+};
+
+/** class holding a set of delayed objects identified by a key, the delayed
+ * object are held by promises or by one shot slots
+ @details the keys can be split over a number of independently locked shards
+ so operations on unrelated keys do not contend on a single lock.  int keys
+ are stored in IndexedSlotTables and assigned to shards by their value modulo
+ the shard count.  Other keys are stored in ordered maps with transparent
+ comparison, so any probe type comparable with the key (std::string_view or
+ const char* for std::string keys) can be used for lookups without
+ constructing a key, and are assigned to shards using the Hash policy*/
+template<class X, class Key, class Hash = DelayedKeyHash<Key>>
+class DelayedObjectTable {
+  public:
+    /// callable run with the value of a key once it is available
+    using Continuation = std::function<void(const X&)>;
+    /// callable used to run continuations instead of running them inline
+    using Executor = std::function<void(std::function<void()>)>;
+
+  private:
+    static constexpr bool indexedKeys{std::is_same_v<Key, int>};
+    using Watcher = detail::CompletionWatcher<Key>;
+    /// a record of when a completed entry was completed or last accessed
+    struct CompletedRecord {
+        Key key;
+        std::chrono::steady_clock::time_point stamp;
+    };
+    /// completed entries in eviction order
+    using RecordList = std::list<CompletedRecord>;
+    /// the consumers of a key along with whether it has been fulfilled
+    struct DelayedEntry {
+        std::optional<std::promise<X>> promise;
+        detail::OneShotReference<X> oneShot;
+        std::vector<Continuation> continuations;
+        /// waiters to notify with the key on completion
+        std::vector<std::weak_ptr<Watcher>> watchers;
+        /** a copy of the value kept for continuations added after
+        completion, not needed if the value is held in a one shot slot*/
+        std::optional<X> value;
+        /// the retention record of a completed entry if it is tracked
+        std::optional<typename RecordList::iterator> record;
+        bool completed{false};
+
+        /** set the value and return the continuations waiting on it
+        @details a one shot slot keeps the value itself, otherwise the value
+        is moved into the future and a copy is kept only if there are
+        continuations or retainValue is set*/
+        template<class V>
+        std::vector<Continuation> fulfill(V&& val, bool retainValue)
+        {
+            completed = true;
+            if constexpr (std::is_copy_constructible_v<X>) {
+                if (!oneShot && (retainValue || !continuations.empty())) {
+                    value.emplace(std::forward<V>(val));
+                    deliver(*value);
+                    return std::exchange(continuations, {});
+                }
+                deliver(std::forward<V>(val));
+                return std::exchange(continuations, {});
+            } else {
+                deliver(std::forward<V>(val));
+                return {};
+            }
+        }
+        /// get the value of a completed entry if it is still available
+        const X* retained() const
+        {
+            if (value) {
+                return &*value;
+            }
+            if (oneShot && oneShot.get()->ready()) {
+                return &oneShot.get()->value();
+            }
+            return nullptr;
+        }
+        template<class V>
+        void deliver(V&& val)
+        {
+            if (oneShot) {
+                oneShot.set(std::forward<V>(val));
+            } else if (promise) {
+                promise->set_value(std::forward<V>(val));
+            }
+        }
+    };
+    using Table =
+        std::conditional_t<indexedKeys,
+                           detail::IndexedSlotTable<DelayedEntry>,
+                           detail::OrderedSlotTable<Key, DelayedEntry>>;
+    /// an independently locked portion of the keys
+    struct Shard {
+        Shard(int stride, int residue): promises(makeTable(stride, residue)) {}
+        std::mutex promiseLock;
+        detail::OneShotPool<X> oneShotPool;
+        /// entries, both fulfilled and unfulfilled
+        Table promises;
+        /// tracked completed entries, the oldest at the front
+        RecordList completedOrder;
+        std::size_t maxCompleted{noLimit};
+        EvictionOrder evictionOrder{EvictionOrder::fifo};
+        std::chrono::steady_clock::duration timeToLive{0};
+        bool retentionEnabled() const
+        {
+            return maxCompleted != noLimit ||
+                timeToLive > std::chrono::steady_clock::duration::zero();
+        }
+    };
+    static constexpr std::size_t noLimit{
+        std::numeric_limits<std::size_t>::max()};
+    std::vector<std::unique_ptr<Shard>> shards;
+    Executor continuationExecutor;
+    bool lateContinuations{true};
+    std::atomic<std::uint64_t> evicted{0};
+
+  public:
+    DelayedObjectTable(): DelayedObjectTable(1) {}
+    /// construct with the keys split over a number of independent shards
+    explicit DelayedObjectTable(std::size_t shardCount)
+    {
+        const auto count = static_cast<int>(std::max<std::size_t>(
+            std::min<std::size_t>(shardCount, maxShards), 1U));
+        shards.reserve(count);
+        for (int ii = 0; ii < count; ++ii) {
+            shards.push_back(std::make_unique<Shard>(count, ii));
+        }
+    }
     /// On destruction set a default value for all object
-    ~DelayedObjects()
+    ~DelayedObjectTable()
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        for (auto& obj : promiseByInteger) {
-            obj.second.set_value(X{});
+        std::vector<Continuation> calls;
+        auto setDefault = [&calls](const auto& key, DelayedEntry& obj) {
+            if (!obj.completed) {
+                appendCalls(calls, obj.fulfill(X{}, false));
+                // a queue outliving the table stops waiting for the key
+                notifyWatchers(key, obj);
+            }
+        };
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->promiseLock);
+            shard->promises.forEach(setDefault);
         }
-        for (auto& obj : promiseByString) {
-            obj.second.set_value(X{});
+        // the executor may not outlive the object so run these inline
+        const X defValue{};
+        for (auto& call : calls) {
+            try {
+                call(defValue);
+            }
+            catch (...) {
+            }
         }
     }
     // not movable or copyable;
-    DelayedObjects(const DelayedObjects&) = delete;
-    DelayedObjects(DelayedObjects&&) = delete;
-    DelayedObjects& operator=(const DelayedObjects&) = delete;
-    DelayedObjects& operator=(DelayedObjects&&) = delete;
+    DelayedObjectTable(const DelayedObjectTable&) = delete;
+    DelayedObjectTable(DelayedObjectTable&&) = delete;
+    DelayedObjectTable& operator=(const DelayedObjectTable&) = delete;
+    DelayedObjectTable& operator=(DelayedObjectTable&&) = delete;
 
-    /// set the value for delayed indexed object
-    void setDelayedValue(int index, const X& val)
+    /// the largest number of shards allowed
+    static constexpr std::size_t maxShards{1024};
+    /// get the number of shards the keys are split over
+    std::size_t shardCount() const { return shards.size(); }
+
+    /// set the value for a delayed object
+    template<class K>
+    void setDelayedValue(const K& key, const X& val)
+    {
+        setValue(key, val);
+    }
+    /// set the value for a delayed object
+    template<class K>
+    void setDelayedValue(const K& key, X&& val)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = promiseByInteger.find(index);
-        if (fnd != promiseByInteger.end()) {
-            fnd->second.set_value(val);
-            usedPromiseByInteger[index] = std::move(fnd->second);
-            promiseByInteger.erase(fnd);
+        setValue(key, std::move(val));
+    }
+    /** check whether the key is known (either fulfilled or unfulfilled)
+    @details a key whose completed entry was evicted by the retention policy
+    is no longer known, just like a key passed to finishedWithValue*/
+    template<class K>
+    bool isRecognized(const K& key)
+    {
+        auto& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.promiseLock);
+        auto* fnd = shard.promises.find(key);
+        if (fnd != nullptr) {
+            touch(shard, *fnd);
         }
+        return (fnd != nullptr);
     }
-    /// set the value for delayed named object
-    void setDelayedValue(const std::string& name, const X& val)
+    /** check whether the key is known and completed
+    @details this is false for a key whose entry was evicted*/
+    template<class K>
+    bool isCompleted(const K& key)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = promiseByString.find(name);
-        if (fnd != promiseByString.end()) {
-            fnd->second.set_value(val);
-            usedPromiseByString[name] = std::move(fnd->second);
-            promiseByString.erase(fnd);
+        auto& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.promiseLock);
+        auto* fnd = shard.promises.find(key);
+        if (fnd != nullptr) {
+            touch(shard, *fnd);
         }
+        return (fnd != nullptr && fnd->completed);
     }
-    void setDelayedValue(int index, X&& val)
+
+    /// For all remaining promises set them to a value of val
+    void fulfillAllPromises(const X& val)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = promiseByInteger.find(index);
-        if (fnd != promiseByInteger.end()) {
-            fnd->second.set_value(std::move(val));
-            usedPromiseByInteger[index] = std::move(fnd->second);
-            promiseByInteger.erase(fnd);
+        std::vector<Continuation> calls;
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->promiseLock);
+            shard->promises.forEach(
+                [this, &val, &calls, &shard](const auto& key,
+                                             DelayedEntry& pr) {
+                    if (!pr.completed) {
+                        appendCalls(calls,
+                                    pr.fulfill(val, lateContinuations));
+                        notifyWatchers(key, pr);
+                        track(*shard, key, pr);
+                    }
+                });
+            enforceRetention(*shard);
         }
+        runContinuations(calls, val);
     }
-    /// set the value for delayed named object
-    void setDelayedValue(const std::string& name, X&& val)
+
+    /** create a delayed object for a key
+    @details requesting a new future for a key replaces any previous promise
+    for that key*/
+    template<class K>
+    std::future<X> getFuture(const K& key)
+    {
+        auto V = std::promise<X>();
+        auto fut = V.get_future();
+        auto& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.promiseLock);
+        resetEntry(shard, *shard.promises.emplace(key).first).promise =
+            std::move(V);
+        return fut;
+    }
+    /** create a delayed object for a key using a pooled one shot slot
+    @details this avoids the allocation and locking of a std::promise and
+    std::future pair, the slot is returned to the pool once both the handle
+    and the entry are released (finishedWithValue)*/
+    template<class K>
+    OneShotFuture<X> getOneShotFuture(const K& key)
+    {
+        auto& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.promiseLock);
+        auto& entry = resetEntry(shard, *shard.promises.emplace(key).first);
+        entry.oneShot = shard.oneShotPool.acquire();
+        return OneShotFuture<X>(entry.oneShot.get());
+    }
+    /** set the values for a range of key/value pairs
+    @details each shard is locked once for the whole batch
+    @return a vector with true for each key that had a pending request, in
+    the order of the input*/
+    template<class KeyValueRange>
+    std::vector<bool> setDelayedValues(const KeyValueRange& values)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = promiseByString.find(name);
-        if (fnd != promiseByString.end()) {
-            fnd->second.set_value(std::move(val));
-            usedPromiseByString[name] = std::move(fnd->second);
-            promiseByString.erase(fnd);
+        std::vector<const std::decay_t<decltype(*std::begin(values))>*> items;
+        for (const auto& element : values) {
+            items.push_back(&element);
         }
+        std::vector<bool> results(items.size(), false);
+        std::vector<std::pair<std::vector<Continuation>, std::size_t>> calls;
+        forEachByShard(
+            items.size(),
+            [&items](std::size_t ii) -> const auto& {
+                return items[ii]->first;
+            },
+            [this, &items, &results, &calls](Shard& shard, std::size_t ii) {
+                const auto& key = items[ii]->first;
+                auto* fnd = shard.promises.find(key);
+                if (fnd != nullptr && !fnd->completed) {
+                    auto ready =
+                        fnd->fulfill(items[ii]->second, lateContinuations);
+                    if (!ready.empty()) {
+                        calls.emplace_back(std::move(ready), ii);
+                    }
+                    results[ii] = true;
+                    notifyWatchers(key, *fnd);
+                    track(shard, key, *fnd);
+                    enforceRetention(shard);
+                }
+            });
+        for (auto& call : calls) {
+            runContinuations(call.first, items[call.second]->second);
+        }
+        return results;
     }
-    /// check whether the index is known (either fulfilled or unfulfilled)
-    bool isRecognized(int index)
+    /** create delayed objects for a range of keys
+    @details each shard is locked once for the whole batch
+    @return the futures in the order of the input keys*/
+    template<class KeyRange>
+    std::vector<std::future<X>> getFutures(const KeyRange& keys)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = promiseByInteger.find(index);
-        if (fnd != promiseByInteger.end()) {
-            return true;
+        std::vector<const std::decay_t<decltype(*std::begin(keys))>*> items;
+        for (const auto& key : keys) {
+            items.push_back(&key);
         }
-        auto fnd2 = usedPromiseByInteger.find(index);
-        if (fnd2 != usedPromiseByInteger.end()) {
-            return true;
+        std::vector<std::promise<X>> promises(items.size());
+        std::vector<std::future<X>> futures;
+        futures.reserve(items.size());
+        for (auto& promise : promises) {
+            futures.push_back(promise.get_future());
         }
-        return false;
+        forEachByShard(
+            items.size(),
+            [&items](std::size_t ii) -> const auto& { return *items[ii]; },
+            [&items, &promises](Shard& shard, std::size_t ii) {
+                auto* entry = shard.promises.emplace(*items[ii]).first;
+                resetEntry(shard, *entry).promise = std::move(promises[ii]);
+            });
+        return futures;
     }
-    /// check whether the name is known (either fulfilled or unfulfilled)
-    bool isRecognized(const std::string& name)
+    /** run a callable with the value for a key once it is available
+    @details the callable runs on the thread supplying the value, or through
+    the executor if one is set.  If the value is already available it runs
+    before this call returns.  Continuations are additive and are not
+    cancelled by a later getFuture for the same key.  If the object is
+    destroyed first the callable is run with a default value
+    @return true if the value was already available
+    @throw std::logic_error if the key is complete but its value was not
+    kept because late continuations were disabled*/
+    template<class K, class Callable>
+    bool getContinuation(const K& key, Callable&& callable)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = promiseByString.find(name);
-        if (fnd != promiseByString.end()) {
-            return true;
+        static_assert(std::is_copy_constructible_v<X>,
+                      "continuations require a copyable value type");
+        Continuation call(std::forward<Callable>(callable));
+        std::optional<X> available;
+        {
+            auto& shard = shardFor(key);
+            std::lock_guard<std::mutex> lock(shard.promiseLock);
+            auto* entry = shard.promises.emplace(key).first;
+            if (!entry->completed) {
+                entry->continuations.push_back(std::move(call));
+                return false;
+            }
+            const X* value = entry->retained();
+            if (value == nullptr) {
+                throw std::logic_error(
+                    "the value of a completed key was not kept for late "
+                    "continuations");
+            }
+            available = *value;
+            touch(shard, *entry);
         }
-        auto fnd2 = usedPromiseByString.find(name);
-        if (fnd2 != usedPromiseByString.end()) {
-            return true;
+        std::vector<Continuation> calls;
+        calls.push_back(std::move(call));
+        runContinuations(calls, *available);
+        return true;
+    }
+    /** wait for the first of a set of keys to complete
+    @details keys that are not recognized are ignored, if several keys are
+    already complete the first in the input order is returned
+    @return the key that completed or nullopt if none completed in time*/
+    template<class KeyRange, class Rep, class Period>
+    std::optional<Key>
+        wait_any(const KeyRange& keys,
+                 const std::chrono::duration<Rep, Period>& timeout)
+    {
+        auto watcher = std::make_shared<Watcher>();
+        if (watch(keys, watcher) == 0) {
+            // nothing is pending so there is nothing to wait for
+            return watcher->tryPop();
+        }
+        return watcher->pop(timeout);
+    }
+    /** push the keys of a set of delayed objects to a queue as they complete
+    @details keys that are already complete are pushed immediately in the
+    input order, keys that are not recognized are ignored.  A key is pushed
+    once for each time it is watched and pop on the queue returns without
+    waiting once no watched key is pending*/
+    template<class KeyRange>
+    void watchCompletions(const KeyRange& keys,
+                          DelayedCompletionQueue<Key>& queue)
+    {
+        watch(keys, queue.watcher);
+    }
+    /** set an executor to run continuations on
+    @details with no executor continuations run inline on the thread that
+    supplies the value, this should be set before any continuations are
+    added*/
+    void setContinuationExecutor(Executor executor)
+    {
+        continuationExecutor = std::move(executor);
+    }
+    /** set whether completed keys keep a copy of their value so
+    continuations added after completion can run
+    @details this is enabled by default, disabling it moves values
+    delivered to a std::future without copying but getContinuation then
+    throws for keys that completed without continuations.  Values held in
+    one shot slots are always available.  This should be set before any
+    values are delivered*/
+    void setLateContinuations(bool enable) { lateContinuations = enable; }
+    /** set a limit on the completed entries retained for finishedWithValue
+    @details completed entries beyond maxCompleted are evicted in the given
+    order and entries are evicted once they have been completed for longer
+    than timeToLive (zero for no limit).  In lru order the time to live is
+    measured from the last access.  An evicted key behaves as if
+    finishedWithValue had been called for it: isRecognized and isCompleted
+    return false, setDelayedValue ignores it, and getFuture starts a new
+    request.  Unfulfilled entries are never evicted.  The limit is divided
+    over the shards, so a shard can evict while others are below their share
+    but the total retained never exceeds maxCompleted.  Entries completed
+    before the policy is set are not subject to it*/
+    void setCompletedRetention(
+        std::size_t maxCompleted,
+        EvictionOrder order = EvictionOrder::fifo,
+        std::chrono::steady_clock::duration timeToLive =
+            std::chrono::steady_clock::duration::zero())
+    {
+        // the remainder is spread over the first shards so the per shard
+        // limits add up to maxCompleted exactly
+        const auto perShard = maxCompleted / shards.size();
+        const auto remainder = maxCompleted % shards.size();
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            auto& shard = shards[ii];
+            std::lock_guard<std::mutex> lock(shard->promiseLock);
+            shard->maxCompleted = (maxCompleted == noLimit) ?
+                noLimit :
+                perShard + ((ii < remainder) ? 1U : 0U);
+            shard->evictionOrder = order;
+            shard->timeToLive = timeToLive;
+            enforceRetention(*shard);
+        }
+    }
+    /** evict completed entries whose time to live has passed
+    @details this is otherwise only checked as values are delivered*/
+    void evictExpired()
+    {
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->promiseLock);
+            enforceRetention(*shard);
+        }
+    }
+    /// get the number of completed entries evicted by the retention policy
+    std::uint64_t evictedCount() const { return evicted.load(); }
+    /// Indicate that the user is finished accessing a value and it can be
+    /// deleted
+    template<class K>
+    void finishedWithValue(const K& key)
+    {
+        auto& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.promiseLock);
+        auto* fnd = shard.promises.find(key);
+        if (fnd != nullptr && fnd->completed) {
+            untrack(shard, *fnd);
+            shard.promises.erase(key);
         }
-        return false;
     }
 
-    /// check whether the index is known and completed
-    bool isCompleted(int index)
+  private:
+    static Table makeTable(int stride, int residue)
+    {
+        if constexpr (indexedKeys) {
+            return Table(stride, residue);
+        } else {
+            return Table{};
+        }
+    }
+    template<class K>
+    std::size_t shardIndex(const K& key) const
+    {
+        if constexpr (indexedKeys) {
+            const auto count = static_cast<int>(shards.size());
+            const auto index = static_cast<int>(key);
+            return static_cast<std::size_t>(((index % count) + count) % count);
+        } else {
+            return (shards.size() == 1) ? 0 : Hash{}(key) % shards.size();
+        }
+    }
+    template<class K>
+    Shard& shardFor(const K& key)
+    {
+        return *shards[shardIndex(key)];
+    }
+    /** call action(shard, ii) for ii in [0, count) with the shard of each
+    key locked, each shard is locked once and the positions within a shard are
+    visited in order*/
+    template<class KeyOf, class Action>
+    void forEachByShard(std::size_t count, KeyOf&& keyOf, Action&& action)
+    {
+        if (shards.size() == 1) {
+            std::lock_guard<std::mutex> lock(shards.front()->promiseLock);
+            for (std::size_t ii = 0; ii < count; ++ii) {
+                action(*shards.front(), ii);
+            }
+            return;
+        }
+        // counting sort of the positions by shard
+        std::vector<std::size_t> shardOf(count);
+        std::vector<std::size_t> starts(shards.size() + 1, 0);
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            shardOf[ii] = shardIndex(keyOf(ii));
+            ++starts[shardOf[ii] + 1];
+        }
+        for (std::size_t jj = 1; jj < starts.size(); ++jj) {
+            starts[jj] += starts[jj - 1];
+        }
+        std::vector<std::size_t> order(count);
+        auto next = starts;
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            order[next[shardOf[ii]]++] = ii;
+        }
+        for (std::size_t jj = 0; jj < shards.size(); ++jj) {
+            if (starts[jj] == starts[jj + 1]) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(shards[jj]->promiseLock);
+            for (auto kk = starts[jj]; kk < starts[jj + 1]; ++kk) {
+                action(*shards[jj], order[kk]);
+            }
+        }
+    }
+    /** attach a watcher to a set of keys, completed keys are pushed
+    immediately
+    @return the number of pending entries the watcher was attached to, 0 if
+    there is nothing to wait for*/
+    template<class KeyRange>
+    std::size_t watch(const KeyRange& keys,
+                      const std::shared_ptr<Watcher>& watcher)
+    {
+        std::size_t attached{0};
+        for (const auto& key : keys) {
+            auto& shard = shardFor(key);
+            std::lock_guard<std::mutex> lock(shard.promiseLock);
+            auto* entry = shard.promises.find(key);
+            if (entry == nullptr) {
+                continue;
+            }
+            if (entry->completed) {
+                watcher->push(Key(key));
+                continue;
+            }
+            auto& watchers = entry->watchers;
+            watchers.erase(std::remove_if(watchers.begin(),
+                                          watchers.end(),
+                                          [](const auto& weak) {
+                                              return weak.expired();
+                                          }),
+                           watchers.end());
+            watchers.push_back(watcher);
+            watcher->expect();
+            ++attached;
+        }
+        return attached;
+    }
+    /// push the key of a newly completed entry to the live watchers
+    template<class K>
+    static void notifyWatchers(const K& key, DelayedEntry& entry)
+    {
+        if (entry.watchers.empty()) {
+            return;
+        }
+        for (auto& weak : std::exchange(entry.watchers, {})) {
+            if (auto watcher = weak.lock()) {
+                watcher->complete(Key(key));
+            }
+        }
+    }
+    /// clear the consumer of an entry before a new request for the key
+    static DelayedEntry& resetEntry(Shard& shard, DelayedEntry& entry)
+    {
+        untrack(shard, entry);
+        entry.oneShot.reset();
+        entry.promise.reset();
+        entry.value.reset();
+        entry.completed = false;
+        return entry;
+    }
+    template<class K, class V>
+    void setValue(const K& key, V&& val)
+    {
+        std::vector<Continuation> calls;
+        std::optional<X> delivered;
+        {
+            auto& shard = shardFor(key);
+            std::lock_guard<std::mutex> lock(shard.promiseLock);
+            auto* fnd = shard.promises.find(key);
+            if (fnd == nullptr || fnd->completed) {
+                return;
+            }
+            calls = fnd->fulfill(std::forward<V>(val), lateContinuations);
+            if constexpr (std::is_copy_constructible_v<X>) {
+                if (!calls.empty()) {
+                    // the entry may be removed once the lock is released
+                    delivered = *fnd->retained();
+                }
+            }
+            notifyWatchers(key, *fnd);
+            track(shard, key, *fnd);
+            enforceRetention(shard);
+        }
+        // only copyable values can have continuations
+        if constexpr (std::is_copy_constructible_v<X>) {
+            if (!calls.empty()) {
+                runContinuations(calls, *delivered);
+            }
+        }
+    }
+    /// add a retention record for a newly completed entry
+    template<class K>
+    static void track(Shard& shard, const K& key, DelayedEntry& entry)
+    {
+        if (!shard.retentionEnabled()) {
+            return;
+        }
+        entry.record = shard.completedOrder.insert(
+            shard.completedOrder.end(),
+            CompletedRecord{Key(key), std::chrono::steady_clock::now()});
+    }
+    /** move an accessed completed entry to the back of the lru order
+    @details the record is relinked in place so no key is constructed*/
+    static void touch(Shard& shard, DelayedEntry& entry)
+    {
+        if (!entry.record || shard.evictionOrder != EvictionOrder::lru) {
+            return;
+        }
+        auto record = *entry.record;
+        shard.completedOrder.splice(
+            shard.completedOrder.end(), shard.completedOrder, record);
+        record->stamp = std::chrono::steady_clock::now();
+    }
+    /// remove the retention record of an entry
+    static void untrack(Shard& shard, DelayedEntry& entry)
+    {
+        if (entry.record) {
+            shard.completedOrder.erase(*entry.record);
+            entry.record.reset();
+        }
+    }
+    /// evict completed entries over the limit or past their time to live
+    void enforceRetention(Shard& shard)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const bool expires =
+            shard.timeToLive > std::chrono::steady_clock::duration::zero();
+        while (!shard.completedOrder.empty()) {
+            const auto& record = shard.completedOrder.front();
+            if (shard.completedOrder.size() <= shard.maxCompleted &&
+                (!expires || now - record.stamp < shard.timeToLive)) {
+                break;
+            }
+            shard.promises.erase(record.key);
+            shard.completedOrder.pop_front();
+            ++evicted;
+        }
+    }
+    static void appendCalls(std::vector<Continuation>& calls,
+                            std::vector<Continuation>&& ready)
+    {
+        for (auto& call : ready) {
+            calls.push_back(std::move(call));
+        }
+    }
+    /// run continuations inline or through the executor, never under a lock
+    void runContinuations(std::vector<Continuation>& calls, const X& val)
+    {
+        for (auto& call : calls) {
+            if (continuationExecutor) {
+                continuationExecutor(
+                    [call = std::move(call), val]() { call(val); });
+            } else {
+                call(val);
+            }
+        }
+    }
+};
+
+/** class holding a set of delayed objects, the delayed object are held by
+ * promises or by one shot slots
+ @details objects are identified by either an integer index or a name, the
+ two kinds of key are held in separate DelayedObjectTables which share the
+ shard count and continuation executor*/
+template<class X>
+class DelayedObjects {
+  public:
+    using Continuation = typename DelayedObjectTable<X, int>::Continuation;
+    using Executor = typename DelayedObjectTable<X, int>::Executor;
+
+    DelayedObjects() = default;
+    /// construct with the keys split over a number of independent shards
+    explicit DelayedObjects(std::size_t shardCount):
+        objectsByIndex(shardCount), objectsByName(shardCount)
+    {
+    }
+
+    /// get the number of shards the keys are split over
+    std::size_t shardCount() const { return objectsByIndex.shardCount(); }
+
+    /// set the value for delayed indexed object
+    void setDelayedValue(int index, const X& val)
+    {
+        objectsByIndex.setDelayedValue(index, val);
+    }
+    /// set the value for delayed named object
+    void setDelayedValue(std::string_view name, const X& val)
+    {
+        objectsByName.setDelayedValue(name, val);
+    }
+    void setDelayedValue(int index, X&& val)
+    {
+        objectsByIndex.setDelayedValue(index, std::move(val));
+    }
+    /// set the value for delayed named object
+    void setDelayedValue(std::string_view name, X&& val)
+    {
+        objectsByName.setDelayedValue(name, std::move(val));
+    }
+    /// check whether the index is known (either fulfilled or unfulfilled)
+    bool isRecognized(int index) { return objectsByIndex.isRecognized(index); }
+    /// check whether the name is known (either fulfilled or unfulfilled)
+    bool isRecognized(std::string_view name)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = usedPromiseByInteger.find(index);
-        return (fnd != usedPromiseByInteger.end());
+        return objectsByName.isRecognized(name);
     }
+
+    /// check whether the index is known and completed
+    bool isCompleted(int index) { return objectsByIndex.isCompleted(index); }
     /// check whether the string is known and completed
-    bool isCompleted(const std::string& name)
+    bool isCompleted(std::string_view name)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = usedPromiseByString.find(name);
-        return (fnd != usedPromiseByString.end());
+        return objectsByName.isCompleted(name);
     }
 
     /// For all remaining promises set them to a value of val
     void fulfillAllPromises(const X& val)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        for (auto& pr : promiseByInteger) {
-            pr.second.set_value(val);
-            usedPromiseByInteger[pr.first] = std::move(pr.second);
-        }
-        for (auto& pr : promiseByString) {
-            pr.second.set_value(val);
-            usedPromiseByString[pr.first] = std::move(pr.second);
-        }
-        promiseByInteger.clear();
-        promiseByString.clear();
+        objectsByIndex.fulfillAllPromises(val);
+        objectsByName.fulfillAllPromises(val);
     }
 
-    /// create a delayed object with an index
+    /** create a delayed object with an index
+    @details requesting a new future for an index replaces any previous
+    promise for that index*/
     std::future<X> getFuture(int index)
     {
-        auto V = std::promise<X>();
-        auto fut = V.get_future();
-        std::lock_guard<std::mutex> lock(promiseLock);
-        promiseByInteger[index] = std::move(V);
-        return fut;
+        return objectsByIndex.getFuture(index);
     }
     /// create a delayed object with a name
-    std::future<X> getFuture(const std::string& name)
+    std::future<X> getFuture(std::string_view name)
     {
-        auto V = std::promise<X>();
-        auto fut = V.get_future();
-        std::lock_guard<std::mutex> lock(promiseLock);
-        promiseByString[name] = std::move(V);
-        return fut;
+        return objectsByName.getFuture(name);
+    }
+    /// create a delayed object with an index using a pooled one shot slot
+    OneShotFuture<X> getOneShotFuture(int index)
+    {
+        return objectsByIndex.getOneShotFuture(index);
+    }
+    /// create a delayed object with a name using a pooled one shot slot
+    OneShotFuture<X> getOneShotFuture(std::string_view name)
+    {
+        return objectsByName.getOneShotFuture(name);
+    }
+    /** set the values for a range of key/value pairs
+    @details the keys must be all integers or all names
+    @return a vector with true for each key that had a pending request, in
+    the order of the input*/
+    template<class KeyValueRange>
+    std::vector<bool> setDelayedValues(const KeyValueRange& values)
+    {
+        using KeyType = std::decay_t<decltype(std::begin(values)->first)>;
+        if constexpr (std::is_integral_v<KeyType>) {
+            return objectsByIndex.setDelayedValues(values);
+        } else {
+            return objectsByName.setDelayedValues(values);
+        }
+    }
+    /** create delayed objects for a range of keys
+    @details the keys must be all integers or all names
+    @return the futures in the order of the input keys*/
+    template<class KeyRange>
+    std::vector<std::future<X>> getFutures(const KeyRange& keys)
+    {
+        using KeyType = std::decay_t<decltype(*std::begin(keys))>;
+        if constexpr (std::is_integral_v<KeyType>) {
+            return objectsByIndex.getFutures(keys);
+        } else {
+            return objectsByName.getFutures(keys);
+        }
+    }
+    /// run a callable with the value for an index once it is available
+    template<class Callable>
+    bool getContinuation(int index, Callable&& callable)
+    {
+        return objectsByIndex.getContinuation(
+            index, std::forward<Callable>(callable));
+    }
+    /// run a callable with the value for a name once it is available
+    template<class Callable>
+    bool getContinuation(std::string_view name, Callable&& callable)
+    {
+        return objectsByName.getContinuation(
+            name, std::forward<Callable>(callable));
+    }
+    /** wait for the first of a set of keys to complete
+    @details the keys must be all integers or all names
+    @return the key that completed or nullopt if none completed in time*/
+    template<class KeyRange, class Rep, class Period>
+    auto wait_any(const KeyRange& keys,
+                  const std::chrono::duration<Rep, Period>& timeout)
+    {
+        using KeyType = std::decay_t<decltype(*std::begin(keys))>;
+        if constexpr (std::is_integral_v<KeyType>) {
+            return objectsByIndex.wait_any(keys, timeout);
+        } else {
+            return objectsByName.wait_any(keys, timeout);
+        }
+    }
+    /// push the indices of a set of delayed objects to a queue as they
+    /// complete
+    template<class KeyRange>
+    void watchCompletions(const KeyRange& keys,
+                          DelayedCompletionQueue<int>& queue)
+    {
+        objectsByIndex.watchCompletions(keys, queue);
+    }
+    /// push the names of a set of delayed objects to a queue as they
+    /// complete
+    template<class KeyRange>
+    void watchCompletions(const KeyRange& keys,
+                          DelayedCompletionQueue<std::string>& queue)
+    {
+        objectsByName.watchCompletions(keys, queue);
+    }
+    /// set an executor to run continuations on
+    void setContinuationExecutor(const Executor& executor)
+    {
+        objectsByIndex.setContinuationExecutor(executor);
+        objectsByName.setContinuationExecutor(executor);
+    }
+    /// set whether completed keys keep their value for late continuations
+    void setLateContinuations(bool enable)
+    {
+        objectsByIndex.setLateContinuations(enable);
+        objectsByName.setLateContinuations(enable);
+    }
+    /** set a limit on the completed entries retained for finishedWithValue
+    @details the limit applies to the indexed and named objects separately,
+    see DelayedObjectTable::setCompletedRetention*/
+    void setCompletedRetention(
+        std::size_t maxCompleted,
+        EvictionOrder order = EvictionOrder::fifo,
+        std::chrono::steady_clock::duration timeToLive =
+            std::chrono::steady_clock::duration::zero())
+    {
+        objectsByIndex.setCompletedRetention(maxCompleted, order, timeToLive);
+        objectsByName.setCompletedRetention(maxCompleted, order, timeToLive);
+    }
+    /// evict completed entries whose time to live has passed
+    void evictExpired()
+    {
+        objectsByIndex.evictExpired();
+        objectsByName.evictExpired();
+    }
+    /// get the number of completed entries evicted by the retention policy
+    std::uint64_t evictedCount() const
+    {
+        return objectsByIndex.evictedCount() + objectsByName.evictedCount();
     }
     /// Indicate that the user is finished accessing a value by index and it
     /// can be deleted
     void finishedWithValue(int index)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = usedPromiseByInteger.find(index);
-        if (fnd != usedPromiseByInteger.end()) {
-            usedPromiseByInteger.erase(fnd);
-        }
+        objectsByIndex.finishedWithValue(index);
     }
     /// Indicate that the user is finished accessing a value by string and
     /// it can be deleted
-    void finishedWithValue(const std::string& name)
+    void finishedWithValue(std::string_view name)
     {
-        std::lock_guard<std::mutex> lock(promiseLock);
-        auto fnd = usedPromiseByString.find(name);
-        if (fnd != usedPromiseByString.end()) {
-            usedPromiseByString.erase(fnd);
-        }
+        objectsByName.finishedWithValue(name);
     }
+
+  private:
+    DelayedObjectTable<X, int> objectsByIndex;
+    DelayedObjectTable<X, std::string> objectsByName;
 };
 
 }  // namespace gmlc::concurrency
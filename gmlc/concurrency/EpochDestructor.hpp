@@ -0,0 +1,242 @@
+/*
+Copyright (c) 2017-2023,
+Battelle Memorial Institute; Lawrence Livermore National Security, LLC; Alliance
+for Sustainable Energy, LLC.  See the top-level NOTICE for additional details.
+All rights reserved. SPDX-License-Identifier: BSD-3-Clause
+*/
+#pragma once
+
+#ifdef ENABLE_TRIPWIRE
+#    include "TripWire.hpp"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gmlc::concurrency {
+/** helper class to destroy objects once no thread can still be using them
+@details this is an epoch based (quiescent state) alternative to the
+DelayedDestructor.  Threads that access the retired objects register as
+participants and periodically announce a quiescent point where they hold no
+references to retired objects.  Each retired object is tagged with the epoch
+of its retirement and is destroyed once every online participant has passed a
+quiescent point after that epoch, so a sweep only touches the objects that
+are ready instead of polling every pending object.  Objects can be retired as
+raw pointers, unique_ptrs, or shared_ptrs*/
+template<class X>
+class EpochDestructor {
+  public:
+    /** a thread taking part in the reclamation
+    @details the participant methods are lock free and should only be called
+    by the thread owning the participant*/
+    class Participant {
+      public:
+        explicit Participant(EpochDestructor* owner): domain(owner) {}
+        Participant(const Participant&) = delete;
+        Participant& operator=(const Participant&) = delete;
+        /// announce that the thread holds no references to retired objects
+        void quiescent() noexcept
+        {
+            epoch.store(domain->globalEpoch.load());
+        }
+        /** mark the thread as offline so it does not hold up reclamation
+        @details the thread must not hold references to retired objects
+        while offline, this is useful before blocking for a long time*/
+        void goOffline() noexcept { online.store(false); }
+        /// bring the thread back online after a call to goOffline
+        void goOnline() noexcept
+        {
+            epoch.store(domain->globalEpoch.load());
+            online.store(true);
+        }
+        /// check if the participant is currently online
+        bool isOnline() const noexcept { return online.load(); }
+
+      private:
+        friend class EpochDestructor;
+        EpochDestructor* domain;
+        std::atomic<std::uint64_t> epoch{0};
+        std::atomic<bool> online{false};
+        bool registered{false};  //!< protected by the participantLock
+    };
+
+  private:
+    struct RetiredObject {
+        std::uint64_t epoch;
+        std::unique_ptr<X> owned;
+        std::shared_ptr<X> shared;
+    };
+    std::atomic<std::uint64_t> globalEpoch{1};
+    std::mutex participantLock;  //!< protects the list of participants
+    std::deque<Participant> participants;
+    std::mutex retireLock;  //!< protects the retired object list
+    std::deque<RetiredObject> retiredObjects;
+    std::function<void(X* ptr)> callBeforeDeleteFunction;
+#ifdef ENABLE_TRIPWIRE
+    TripWireDetector tripDetect;
+#endif
+
+  public:
+    EpochDestructor() = default;
+    explicit EpochDestructor(std::function<void(X* ptr)> callFirst):
+        callBeforeDeleteFunction(std::move(callFirst))
+    {
+    }
+    ~EpochDestructor()
+    {
+        try {
+            int ii = 0;
+            while (destroyObjects() > 0) {
+                ++ii;
+#ifdef ENABLE_TRIPWIRE
+                // short circuit if the tripline was triggered
+                if (tripDetect.isTripped()) {
+                    break;
+                }
+#endif
+                if (ii > 4) {
+                    break;
+                }
+                if (ii % 2 == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            // anything remaining is destroyed with the container
+            std::lock_guard<std::mutex> lock(retireLock);
+            for (auto& retired : retiredObjects) {
+                callDeleteFunction(retired);
+            }
+        }
+        catch (...) {
+        }
+    }
+    EpochDestructor(EpochDestructor&&) noexcept = delete;
+    EpochDestructor& operator=(EpochDestructor&&) noexcept = delete;
+
+    /** register the calling thread as a participant
+    @details the returned reference remains valid until unregisterThread is
+    called, the participant starts online*/
+    Participant& registerThread()
+    {
+        std::lock_guard<std::mutex> lock(participantLock);
+        Participant* slot{nullptr};
+        for (auto& participant : participants) {
+            if (!participant.registered) {
+                slot = &participant;
+                break;
+            }
+        }
+        if (slot == nullptr) {
+            slot = &participants.emplace_back(this);
+        }
+        slot->registered = true;
+        slot->goOnline();
+        return *slot;
+    }
+    /// remove a participant, it no longer holds up reclamation
+    void unregisterThread(Participant& participant)
+    {
+        std::lock_guard<std::mutex> lock(participantLock);
+        participant.goOffline();
+        participant.registered = false;
+    }
+
+    /// retire an object, ownership is transferred to the destructor
+    void retire(std::unique_ptr<X> obj)
+    {
+        if (obj) {
+            addRetired(RetiredObject{0, std::move(obj), nullptr});
+        }
+    }
+    /// retire an object allocated with new, ownership is transferred
+    void retire(X* obj) { retire(std::unique_ptr<X>(obj)); }
+    /** retire a shared object
+    @details the destructor's reference is released once all participants
+    have passed a quiescent point*/
+    void retire(std::shared_ptr<X> obj)
+    {
+        if (obj) {
+            addRetired(RetiredObject{0, nullptr, std::move(obj)});
+        }
+    }
+
+    /** destroy the retired objects that no participant can still reference
+    @return the number of objects still waiting to be destroyed*/
+    size_t destroyObjects() noexcept
+    {
+        std::size_t remaining{static_cast<std::size_t>(-1)};
+        try {
+            const auto safeEpoch = minimumEpoch();
+            std::vector<RetiredObject> ready;
+            {
+                std::lock_guard<std::mutex> lock(retireLock);
+                while (!retiredObjects.empty() &&
+                       retiredObjects.front().epoch < safeEpoch) {
+                    ready.push_back(std::move(retiredObjects.front()));
+                    retiredObjects.pop_front();
+                }
+                remaining = retiredObjects.size();
+            }
+            // destructors are never called while under the lock
+            for (auto& retired : ready) {
+                callDeleteFunction(retired);
+            }
+        }
+        catch (...) {
+        }
+        return remaining;
+    }
+
+    /// @brief  get the number of objects waiting to be destroyed
+    /// @return number of objects
+    auto size()
+    {
+        std::lock_guard<std::mutex> lock(retireLock);
+        return retiredObjects.size();
+    }
+
+  private:
+    void addRetired(RetiredObject&& retired)
+    {
+        std::lock_guard<std::mutex> lock(retireLock);
+        // tagging under the lock keeps the list ordered by epoch
+        retired.epoch = globalEpoch.fetch_add(1);
+        retiredObjects.push_back(std::move(retired));
+    }
+    /// get the oldest epoch observed by any online participant
+    std::uint64_t minimumEpoch()
+    {
+        std::uint64_t minEpoch = globalEpoch.load();
+        std::lock_guard<std::mutex> lock(participantLock);
+        for (auto& participant : participants) {
+            if (participant.online.load()) {
+                auto epoch = participant.epoch.load();
+                if (epoch < minEpoch) {
+                    minEpoch = epoch;
+                }
+            }
+        }
+        return minEpoch;
+    }
+    void callDeleteFunction(RetiredObject& retired)
+    {
+        if (callBeforeDeleteFunction) {
+            callBeforeDeleteFunction(retired.owned ? retired.owned.get() :
+                                                     retired.shared.get());
+        }
+        retired.owned.reset();
+        retired.shared.reset();
+    }
+};
+
+}  // namespace gmlc::concurrency
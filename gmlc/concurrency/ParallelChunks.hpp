@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2017-2023,
+Battelle Memorial Institute; Lawrence Livermore National Security, LLC; Alliance
+for Sustainable Energy, LLC.  See the top-level NOTICE for additional details.
+All rights reserved. SPDX-License-Identifier: BSD-3-Clause
+*/
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gmlc::concurrency::detail {
+/// callable used to run a task on another thread
+using ChunkExecutor = std::function<void(std::function<void()>)>;
+
+/** a fixed set of threads running submitted tasks
+@details the threads are started on construction and joined on destruction
+once the queued tasks have run, so they can be reused across many calls of
+runInChunks instead of creating threads for each one*/
+class WorkerPool {
+  public:
+    explicit WorkerPool(std::size_t threadCount)
+    {
+        workers.reserve(threadCount);
+        try {
+            for (std::size_t ii = 0; ii < threadCount; ++ii) {
+                workers.emplace_back([this]() { workLoop(); });
+            }
+        }
+        catch (...) {
+            stop();
+            throw;
+        }
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool() { stop(); }
+    /// queue a task to run on one of the threads
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            tasks.push_back(std::move(task));
+        }
+        queueCondition.notify_one();
+    }
+    /// get the number of threads in the pool
+    std::size_t size() const { return workers.size(); }
+
+  private:
+    void workLoop()
+    {
+        std::unique_lock<std::mutex> lock(queueLock);
+        while (true) {
+            queueCondition.wait(
+                lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+            lock.unlock();
+            try {
+                task();
+            }
+            catch (...) {
+            }
+            lock.lock();
+        }
+    }
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+    std::mutex queueLock;
+    std::condition_variable queueCondition;
+    std::deque<std::function<void()>> tasks;
+    bool stopping{false};
+    std::vector<std::thread> workers;
+};
+
+/** get an executor running tasks on a new pool of threadCount threads
+@details the pool is shared by the copies of the executor and is joined when
+the last of them is destroyed, which must not be on one of its own threads*/
+inline ChunkExecutor makePoolExecutor(std::size_t threadCount)
+{
+    auto pool = std::make_shared<WorkerPool>(threadCount);
+    return [pool](std::function<void()> task) {
+        pool->submit(std::move(task));
+    };
+}
+
+/** call runChunk(first, last) over count items split into chunkCount
+contiguous chunks
+@details the chunks after the first are handed to the executor, or run on
+the calling thread if it is empty.  The calling thread runs the first chunk
+and the call returns once all the chunks are complete.  The first exception
+thrown by a chunk is rethrown after that*/
+template<class Func>
+void runInChunks(std::size_t count,
+                 std::size_t chunkCount,
+                 const ChunkExecutor& executor,
+                 Func&& runChunk)
+{
+    if (count == 0) {
+        return;
+    }
+    chunkCount = std::max<std::size_t>(std::min(chunkCount, count), 1U);
+    const std::size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    // the wait is done under the mutex so the counter state is not
+    // destroyed before the last task has released it
+    std::mutex completionLock;
+    std::condition_variable completionCondition;
+    std::size_t outstanding{chunkCount - 1};
+    std::exception_ptr failure;
+    auto runIndex = [&](std::size_t chunk) {
+        const std::size_t first = chunk * chunkSize;
+        const std::size_t last = std::min(first + chunkSize, count);
+        try {
+            runChunk(first, last);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(completionLock);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+    };
+    for (std::size_t chunk = 1; chunk < chunkCount; ++chunk) {
+        auto task = [&, chunk]() {
+            runIndex(chunk);
+            std::lock_guard<std::mutex> lock(completionLock);
+            if (--outstanding == 0) {
+                completionCondition.notify_all();
+            }
+        };
+        if (!executor) {
+            task();
+            continue;
+        }
+        try {
+            executor(task);
+        }
+        catch (...) {
+            // could not hand off the chunk so run it here
+            task();
+        }
+    }
+    runIndex(0);
+    {
+        std::unique_lock<std::mutex> lock(completionLock);
+        completionCondition.wait(lock, [&outstanding]() {
+            return outstanding == 0;
+        });
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+}  // namespace gmlc::concurrency::detail
@@ -9,32 +9,174 @@ All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 #ifdef ENABLE_TRIPWIRE
 #    include "TripWire.hpp"
 #endif
+#include "../libguarded/cow_guarded.hpp"
+#include "ParallelChunks.hpp"
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace gmlc::concurrency {
 
+/// the synchronization used by a SearchableObjectHolder
+enum class HolderMode {
+    locking,  //!< all operations take a single mutex
+    /** readers access an immutable snapshot without locking, writers copy
+    and publish a new snapshot*/
+    snapshot
+};
+
+/** compact reference to an object in a SearchableObjectHolder
+@details the handle holds the index of a slot along with the generation of
+the slot when the handle was issued, so a handle to an object that has since
+been removed is detected instead of resolving to a different object.  The
+top bits are reserved to identify a partition of the container*/
+class ObjectHandle {
+  public:
+    ObjectHandle() = default;
+    ObjectHandle(std::uint32_t slotIndex,
+                 std::uint32_t slotGeneration,
+                 std::uint32_t partition = 0):
+        value((static_cast<std::uint64_t>(partition) << partitionShift) |
+              (static_cast<std::uint64_t>(slotIndex & slotMask) << slotShift) |
+              slotGeneration)
+    {
+    }
+    /// check if the handle was issued for an object, it may still be stale
+    bool isValid() const { return generation() != 0; }
+    std::uint32_t slot() const
+    {
+        return static_cast<std::uint32_t>(value >> slotShift) & slotMask;
+    }
+    std::uint32_t generation() const
+    {
+        return static_cast<std::uint32_t>(value);
+    }
+    std::uint32_t partition() const
+    {
+        return static_cast<std::uint32_t>(value >> partitionShift);
+    }
+    /// get the handle as a single integer
+    std::uint64_t getValue() const { return value; }
+    bool operator==(const ObjectHandle& other) const
+    {
+        return value == other.value;
+    }
+    bool operator!=(const ObjectHandle& other) const
+    {
+        return value != other.value;
+    }
+    /// the largest number of slots a handle can address
+    static constexpr std::uint32_t maxSlots{0x00FFFFFFU};
+
+  private:
+    static constexpr int slotShift{32};
+    static constexpr int partitionShift{56};
+    static constexpr std::uint32_t slotMask{maxSlots};
+    std::uint64_t value{0};
+};
+
 /** helper class to contain a list of objects that need to be referenceable
- * at some level the objects are stored through shared_ptrs*/
+ * at some level the objects are stored through shared_ptrs
+ @details in snapshot mode lookups never block and are never blocked by
+ writers, at the cost of each modification copying the tables.  This suits
+ containers that are read far more often than they are modified.  The names
+ are also indexed by type so typed searches only visit objects of that type,
+ this requires Y to be ordered by operator<.  Each object is assigned a slot
+ so it can also be found through an ObjectHandle without comparing names.
+ The names can be split over a number of independently locked shards by
+ hash so modifications of unrelated names do not contend, operations over
+ the whole container visit each shard in turn*/
 template<class X, class Y = int>
 class SearchableObjectHolder {
+  public:
+    /// callable run when an object is added
+    using AddedCallback = std::function<void(const std::shared_ptr<X>&)>;
+    /// callable used to run search tasks on another thread
+    using Executor = std::function<void(std::function<void()>)>;
+
   private:
-    mutable std::mutex mapLock;
-    std::map<std::string, std::shared_ptr<X>> objectMap;
-    std::map<std::string, std::vector<Y>> typeMap;
+    struct Entry {
+        std::shared_ptr<X> object;
+        std::uint32_t slot{0};
+    };
+    struct Slot {
+        std::shared_ptr<X> object;
+        std::uint32_t generation{1};
+    };
+    using ObjectMap = std::map<std::string, Entry>;
+    using ObjectIterator = typename ObjectMap::iterator;
+    struct Tables {
+        ObjectMap objectMap;
+        /// objects by handle slot, free slots have a null object
+        std::vector<Slot> slots;
+        std::vector<std::uint32_t> freeSlots;
+        std::map<std::string, std::vector<Y>> typeMap;
+        /// inverted index of typeMap
+        std::map<Y, std::set<std::string>> namesByType;
+    };
+    const HolderMode mode{HolderMode::locking};
+    /// identifies the container in the thread local lookup caches
+    const std::uint64_t holderId{nextHolderId()};
+    /// expires with the container so dead cache entries can be pruned
+    const std::shared_ptr<const char> lifetimeToken{std::make_shared<char>()};
+    /// an independently locked portion of the names
+    struct Shard {
+        mutable std::mutex mapLock;
+        Tables tables;  //!< the tables used in locking mode
+        /// the published tables used in snapshot mode
+        libguarded::cow_guarded<Tables> snapshotTables;
+    };
+    std::vector<std::unique_ptr<Shard>> shards;
 #ifdef ENABLE_TRIPWIRE
     TripWireDetector trippedDetect;
 #endif
+    /// protects addCallbacks and orders additions with waitForObject
+    mutable std::mutex addLock;
+    mutable std::condition_variable objectAdded;
+    /// pending callbacks by name with the id returned for each
+    std::map<std::string, std::vector<std::pair<std::uint64_t, AddedCallback>>>
+        addCallbacks;
+    std::uint64_t nextCallbackId{0};
+    /** the number of waiting threads and pending callbacks, additions skip
+    the addLock while this is zero*/
+    mutable std::atomic<std::size_t> addListeners{0};
+    /// the threads used by parallel searches without an executor
+    mutable std::mutex searchPoolLock;
+    mutable Executor searchPool;
+    mutable std::size_t searchPoolSize{0};
+
   public:
-    SearchableObjectHolder() = default;
+    SearchableObjectHolder(): SearchableObjectHolder(HolderMode::locking) {}
+    /// construct with a mode and the names split over a number of shards
+    explicit SearchableObjectHolder(HolderMode holderMode,
+                                    std::size_t shardCount = 1):
+        mode(holderMode)
+    {
+        const auto count =
+            std::max<std::size_t>(std::min(shardCount, maxShards), 1U);
+        shards.reserve(count);
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            shards.push_back(std::make_unique<Shard>());
+        }
+    }
     // class is not movable
     SearchableObjectHolder(SearchableObjectHolder&&) noexcept = delete;
     SearchableObjectHolder&
@@ -47,66 +189,102 @@ class SearchableObjectHolder {
             return;
         }
 #endif
-        std::unique_lock<std::mutex> lock(mapLock);
         int cntr = 0;
-        while (!objectMap.empty()) {
+        // don't leave things locked while sleeping or yielding
+        while (!empty()) {
             ++cntr;
-            lock.unlock();
-            // don't leave things locked while sleeping or yielding
+            if (cntr > 7) {
+                break;
+            }
             if (cntr % 2 != 0) {
                 std::this_thread::yield();
             } else {
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
             }
-
-            lock.lock();
-            if (cntr > 6) {
-                break;
-            }
         }
     }
+    /// the largest number of shards, limited by the ObjectHandle partition
+    static constexpr std::size_t maxShards{256};
+    /// get the synchronization mode of the container
+    HolderMode getMode() const { return mode; }
+    /// get the number of shards the names are split over
+    std::size_t shardCount() const { return shards.size(); }
     /** add and object to container*/
     bool addObject(const std::string& name, std::shared_ptr<X> obj)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto res = objectMap.emplace(name, std::move(obj));
-        return res.second;
+        const auto index = shardIndex(name);
+        if (skipWrite(index, name, true)) {
+            return false;
+        }
+        const bool added = writeTables(index, [&](Tables& tabs) {
+            return insertObject(tabs, name, std::move(obj)).second;
+        });
+        if (added) {
+            notifyAdded(name);
+        }
+        return added;
     }
 
     /** add and object to container*/
     bool addObject(const std::string& name, std::shared_ptr<X> obj, Y type)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto res = objectMap.emplace(name, std::move(obj));
-        if (res.second) {
-            typeMap.emplace(name, std::vector<Y>{type});
+        const auto index = shardIndex(name);
+        if (skipWrite(index, name, true)) {
+            return false;
+        }
+        const bool added = writeTables(index, [&](Tables& tabs) {
+            auto res = insertObject(tabs, name, std::move(obj));
+            // only index the type if it was recorded, a name given types
+            // before it was added keeps those types
+            if (res.second &&
+                tabs.typeMap.emplace(name, std::vector<Y>{type}).second) {
+                tabs.namesByType[type].insert(name);
+            }
+            return res.second;
+        });
+        if (added) {
+            notifyAdded(name);
         }
-        return res.second;
+        return added;
     }
     /** add an additional type reference to the object name*/
     void addType(const std::string& name, Y type)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        typeMap[name].push_back(type);
+        writeTables(shardIndex(name), [&](Tables& tabs) {
+            tabs.typeMap[name].push_back(type);
+            tabs.namesByType[type].insert(name);
+            return true;
+        });
     }
 
     /** check if the container is empty
 @details this is really only useful if there is only one thread adding
 object otherwise the results are not totally reliable upon return
 */
-    bool empty()
+    bool empty() const
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        return objectMap.empty();
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            if (!readTables(ii, [](const Tables& tabs) {
+                    return tabs.objectMap.empty();
+                })) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    /** get a vector of all the contained objects*/
-    std::vector<std::shared_ptr<X>> getObjects()
+    /** get a vector of all the contained objects
+    @details the objects are in name order within each shard*/
+    std::vector<std::shared_ptr<X>> getObjects() const
     {
         std::vector<std::shared_ptr<X>> objs;
-        std::lock_guard<std::mutex> lock(mapLock);
-        for (auto& obj : objectMap) {
-            objs.push_back(obj.second);
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            readTables(ii, [&objs](const Tables& tabs) {
+                objs.reserve(objs.size() + tabs.objectMap.size());
+                for (const auto& obj : tabs.objectMap) {
+                    objs.push_back(obj.second.object);
+                }
+            });
         }
         return objs;
     }
@@ -114,127 +292,990 @@ object otherwise the results are not totally reliable upon return
     /** remove an object from the object holder by name*/
     bool removeObject(const std::string& name)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto fnd = objectMap.find(name);
-        if (fnd != objectMap.end()) {
-            objectMap.erase(fnd);
-            auto fnd2 = typeMap.find(name);
-            if (fnd2 != typeMap.end()) {
-                typeMap.erase(fnd2);
+        const auto index = shardIndex(name);
+        if (skipWrite(index, name, false)) {
+            return false;
+        }
+        return writeTables(index, [&name](Tables& tabs) {
+            auto fnd = tabs.objectMap.find(name);
+            if (fnd == tabs.objectMap.end()) {
+                return false;
             }
+            eraseObject(tabs, fnd);
             return true;
-        }
-
-        return false;
+        });
     }
 
     /** remove an object if it matches a certain criteria as given by the
      * function operator*/
     bool removeObject(std::function<bool(const std::shared_ptr<X>&)> operand)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        for (auto obj = objectMap.begin(); obj != objectMap.end(); ++obj) {
-            if (operand(obj->second)) {
-                objectMap.erase(obj);
-                auto fnd2 = typeMap.find(obj->first);
-                if (fnd2 != typeMap.end()) {
-                    typeMap.erase(fnd2);
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            if (mode == HolderMode::snapshot) {
+                if (removeSnapshotMatch(ii, operand)) {
+                    return true;
                 }
+                continue;
+            }
+            const bool removed = writeTables(ii, [&operand](Tables& tabs) {
+                for (auto obj = tabs.objectMap.begin();
+                     obj != tabs.objectMap.end();
+                     ++obj) {
+                    if (operand(obj->second.object)) {
+                        eraseObject(tabs, obj);
+                        return true;
+                    }
+                }
+                return false;
+            });
+            if (removed) {
                 return true;
             }
         }
         return false;
     }
 
+    /** remove all the objects whose names start with a prefix
+    @details this is a range query over the sorted names so it takes time
+    proportional to the number of matching objects
+    @return the number of objects removed*/
+    std::size_t removeObjectsWithPrefix(const std::string& prefix)
+    {
+        std::size_t removed{0};
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            // skip shards without a match to avoid copying a snapshot
+            const bool found = readTables(ii, [&prefix](const Tables& tabs) {
+                auto entry = prefixBegin(tabs, prefix);
+                return entry != tabs.objectMap.end() &&
+                    hasPrefix(entry->first, prefix);
+            });
+            if (!found) {
+                continue;
+            }
+            removed += writeTables(ii, [&prefix](Tables& tabs) {
+                std::size_t count{0};
+                auto entry = prefixBegin(tabs, prefix);
+                while (entry != tabs.objectMap.end() &&
+                       hasPrefix(entry->first, prefix)) {
+                    auto next = std::next(entry);
+                    eraseObject(tabs, entry);
+                    entry = next;
+                    ++count;
+                }
+                return count;
+            });
+        }
+        return removed;
+    }
+
+    /** add a second name for an object along with its types
+    @details if the names are in different shards the source is read and
+    then the copy is added, so the copy reflects the source at the time it
+    was read*/
     bool copyObject(const std::string& copyFromName,
                     const std::string& copyToName)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto fnd = objectMap.find(copyFromName);
-        if (fnd != objectMap.end()) {
-            auto newObjectPtr = fnd->second;
-            auto ret = objectMap.emplace(copyToName, std::move(newObjectPtr));
-            if (ret.second) {
-                auto fnd2 = typeMap.find(fnd->first);
-                if (fnd2 != typeMap.end()) {
-                    typeMap.emplace(copyToName, fnd2->second);
+        const auto fromIndex = shardIndex(copyFromName);
+        const auto toIndex = shardIndex(copyToName);
+        bool added{false};
+        if (skipWrite(toIndex, copyToName, true)) {
+            return false;
+        }
+        if (fromIndex == toIndex) {
+            added = writeTables(toIndex, [&](Tables& tabs) {
+                auto fnd = tabs.objectMap.find(copyFromName);
+                if (fnd == tabs.objectMap.end()) {
+                    return false;
+                }
+                auto newObjectPtr = fnd->second.object;
+                auto types = typesOf(tabs, copyFromName);
+                if (!insertObject(tabs, copyToName, std::move(newObjectPtr))
+                         .second) {
+                    return false;
+                }
+                addTypes(tabs, copyToName, std::move(types));
+                return true;
+            });
+        } else {
+            std::optional<std::pair<std::shared_ptr<X>, std::vector<Y>>>
+                source;
+            readTables(fromIndex, [&](const Tables& tabs) {
+                auto fnd = tabs.objectMap.find(copyFromName);
+                if (fnd != tabs.objectMap.end()) {
+                    source.emplace(fnd->second.object,
+                                   typesOf(tabs, copyFromName));
                 }
+            });
+            if (!source) {
+                return false;
             }
-
-            return ret.second;
+            added = writeTables(toIndex, [&](Tables& tabs) {
+                if (!insertObject(tabs, copyToName, std::move(source->first))
+                         .second) {
+                    return false;
+                }
+                addTypes(tabs, copyToName, std::move(source->second));
+                return true;
+            });
         }
-        return false;
+        if (added) {
+            notifyAdded(copyToName);
+        }
+        return added;
     }
-    /** check if an object is of a specific type*/
-    bool checkObjectType(const std::string& name, Y type) const
+    /** add a range of (name, object) pairs
+    @details each shard is locked once for the whole batch and names that
+    arrive in sorted order are inserted with a position hint
+    @return a vector with true for each object that was added, in the order
+    of the input*/
+    template<class NameObjectRange>
+    std::vector<bool> addObjects(const NameObjectRange& objects)
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto fnd = typeMap.find(name);
-        if (fnd != typeMap.end()) {
-            for (auto& stype : fnd->second) {
-                if (stype == type) {
-                    return true;
-                }
+        using Name = std::decay_t<decltype(std::begin(objects)->first)>;
+        if constexpr (std::is_same_v<Name, std::string>) {
+            return addObjectBatch(objects);
+        } else {
+            // convert the names once so the batch only refers to strings
+            // that outlive it
+            std::vector<std::pair<std::string, std::shared_ptr<X>>> converted;
+            for (const auto& element : objects) {
+                converted.emplace_back(element.first, element.second);
             }
+            return addObjectBatch(converted);
         }
-        return false;
+    }
+    /** remove a range of names
+    @details each shard is locked once for the whole batch
+    @return a vector with true for each name that was removed, in the order
+    of the input*/
+    template<class NameRange>
+    std::vector<bool> removeObjects(const NameRange& names)
+    {
+        using Name = std::decay_t<decltype(*std::begin(names))>;
+        if constexpr (std::is_same_v<Name, std::string>) {
+            return removeObjectBatch(names);
+        } else {
+            // convert the names once so the batch only refers to strings
+            // that outlive it
+            return removeObjectBatch(
+                std::vector<std::string>(std::begin(names), std::end(names)));
+        }
+    }
+    /** check if an object is of a specific type*/
+    bool checkObjectType(const std::string& name, Y type) const
+    {
+        return readTables(shardIndex(name), [&name, &type](const Tables& tabs) {
+            return hasType(tabs, name, type);
+        });
     }
 
-    std::shared_ptr<X> findObject(const std::string& name)
+    std::shared_ptr<X> findObject(const std::string& name) const
     {
 #ifdef ENABLE_TRIPWIRE
         if (trippedDetect.isTripped()) {
             return nullptr;
         }
 #endif
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto fnd = objectMap.find(name);
-        if (fnd != objectMap.end()) {
-            return fnd->second;
-        }
-        return nullptr;
+        return readTables(shardIndex(name),
+                          [&name](const Tables& tabs) -> std::shared_ptr<X> {
+                              auto fnd = tabs.objectMap.find(name);
+                              if (fnd != tabs.objectMap.end()) {
+                                  return fnd->second.object;
+                              }
+                              return nullptr;
+                          });
     }
 
     std::shared_ptr<X>
-        findObject(std::function<bool(const std::shared_ptr<X>&)> operand)
+        findObject(std::function<bool(const std::shared_ptr<X>&)> operand) const
     {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto obj =
-            std::find_if(objectMap.begin(),
-                         objectMap.end(),
-                         [&operand](auto& val) { return operand(val.second); });
-        if (obj != objectMap.end()) {
-            return obj->second;
-        }
-        return nullptr;
+        return findInShards(
+            [&operand](const Tables& tabs) -> std::shared_ptr<X> {
+                auto obj = std::find_if(tabs.objectMap.begin(),
+                                        tabs.objectMap.end(),
+                                        [&operand](auto& val) {
+                                            return operand(val.second.object);
+                                        });
+                if (obj != tabs.objectMap.end()) {
+                    return obj->second.object;
+                }
+                return nullptr;
+            });
     }
     /** find an object whose operand evaluates to true and matches a
      * specific type*/
     std::shared_ptr<X>
         findObject(std::function<bool(const std::shared_ptr<X>&)> operand,
-                   Y type)
-    {
-        std::lock_guard<std::mutex> lock(mapLock);
-        auto obj = std::find_if(objectMap.begin(),
-                                objectMap.end(),
-                                [&operand, this, type](auto& val) {
-                                    if (operand(val.second)) {
-                                        auto tfind = typeMap.find(val.first);
-                                        if (tfind != typeMap.end()) {
-                                            for (auto& t : tfind->second) {
-                                                if (t == type) {
-                                                    return true;
-                                                }
-                                            }
-                                        }
+                   Y type) const
+    {
+        return findInShards([&operand,
+                             &type](const Tables& tabs) -> std::shared_ptr<X> {
+            auto names = tabs.namesByType.find(type);
+            if (names == tabs.namesByType.end()) {
+                return nullptr;
+            }
+            for (const auto& name : names->second) {
+                auto obj = tabs.objectMap.find(name);
+                if (obj != tabs.objectMap.end() &&
+                    operand(obj->second.object)) {
+                    return obj->second.object;
+                }
+            }
+            return nullptr;
+        });
+    }
+    /** find the first object in getObjects order whose operand evaluates to
+    true, splitting the search over a number of workers
+    @details the operand runs while the shards are locked in locking mode or
+    on the current snapshots in snapshot mode, the same as findObject, and it
+    must be safe to call concurrently.  Chunks later than a found match stop
+    early.  The chunks are handed to the executor if given or to a pool of
+    threads kept by the holder otherwise and the calling thread searches the
+    first chunk*/
+    std::shared_ptr<X> findObjectParallel(
+        std::function<bool(const std::shared_ptr<X>&)> operand,
+        std::size_t workerCount,
+        const Executor& executor = nullptr) const
+    {
+        constexpr auto noMatch = (std::numeric_limits<std::size_t>::max)();
+        return searchObjects([&](const auto& objs) -> std::shared_ptr<X> {
+            std::atomic<std::size_t> firstMatch{noMatch};
+            detail::runInChunks(
+                objs.size(),
+                workerCount,
+                searchExecutor(workerCount, executor),
+                [&objs, &operand, &firstMatch](std::size_t first,
+                                               std::size_t last) {
+                    for (auto ii = first; ii < last && ii < firstMatch.load();
+                         ++ii) {
+                        if (operand(*objs[ii])) {
+                            auto current = firstMatch.load();
+                            while (ii < current &&
+                                   !firstMatch.compare_exchange_weak(current,
+                                                                     ii)) {
+                            }
+                            return;
+                        }
+                    }
+                });
+            return (firstMatch.load() == noMatch) ? nullptr :
+                                                    *objs[firstMatch.load()];
+        });
+    }
+    /** get all the objects whose operand evaluates to true in getObjects
+    order
+    @details with more than one worker the search is split the same way as
+    findObjectParallel*/
+    std::vector<std::shared_ptr<X>>
+        findObjects(std::function<bool(const std::shared_ptr<X>&)> operand,
+                    std::size_t workerCount = 1,
+                    const Executor& executor = nullptr) const
+    {
+        return searchObjects([&](const auto& objs) {
+            // char instead of bool so the chunks can be written concurrently
+            std::vector<char> matched(objs.size(), 0);
+            detail::runInChunks(objs.size(),
+                                workerCount,
+                                searchExecutor(workerCount, executor),
+                                [&objs, &operand, &matched](std::size_t first,
+                                                            std::size_t last) {
+                                    for (auto ii = first; ii < last; ++ii) {
+                                        matched[ii] =
+                                            operand(*objs[ii]) ? 1 : 0;
                                     }
-                                    return false;
                                 });
-        if (obj != objectMap.end()) {
-            return obj->second;
+            std::vector<std::shared_ptr<X>> found;
+            for (std::size_t ii = 0; ii < objs.size(); ++ii) {
+                if (matched[ii] != 0) {
+                    found.push_back(*objs[ii]);
+                }
+            }
+            return found;
+        });
+    }
+    /** get all the objects whose names start with a prefix
+    @details the objects are in name order within each shard, only the
+    matching range of the sorted names is visited*/
+    std::vector<std::shared_ptr<X>>
+        findObjectsWithPrefix(const std::string& prefix) const
+    {
+        std::vector<std::shared_ptr<X>> objs;
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            readTables(ii, [&objs, &prefix](const Tables& tabs) {
+                for (auto entry = prefixBegin(tabs, prefix);
+                     entry != tabs.objectMap.end() &&
+                     hasPrefix(entry->first, prefix);
+                     ++entry) {
+                    objs.push_back(entry->second.object);
+                }
+            });
+        }
+        return objs;
+    }
+    /** get a vector of all the contained objects of a specific type*/
+    std::vector<std::shared_ptr<X>> getObjectsOfType(Y type) const
+    {
+        std::vector<std::shared_ptr<X>> objs;
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            readTables(ii, [&objs, &type](const Tables& tabs) {
+                auto names = tabs.namesByType.find(type);
+                if (names == tabs.namesByType.end()) {
+                    return;
+                }
+                for (const auto& name : names->second) {
+                    auto obj = tabs.objectMap.find(name);
+                    if (obj != tabs.objectMap.end()) {
+                        objs.push_back(obj->second.object);
+                    }
+                }
+            });
+        }
+        return objs;
+    }
+
+    /** call func(const X&) on the object with a name without copying the
+    shared_ptr
+    @details in locking mode func runs under the lock so it must not modify
+    the container
+    @return true if the object was found and func was called*/
+    template<class Func>
+    bool withObject(const std::string& name, Func&& func) const
+    {
+        return readTables(shardIndex(name), [&name, &func](const Tables& tabs) {
+            auto fnd = tabs.objectMap.find(name);
+            if (fnd == tabs.objectMap.end() || !fnd->second.object) {
+                return false;
+            }
+            func(static_cast<const X&>(*fnd->second.object));
+            return true;
+        });
+    }
+    /** call func(name, const X&) for every object in name order within
+    each shard
+    @details no shared_ptrs are copied and nothing is allocated, in locking
+    mode func runs under the lock so it must not modify the container*/
+    template<class Func>
+    void forEach(Func&& func) const
+    {
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            readTables(ii, [&func](const Tables& tabs) {
+                for (const auto& obj : tabs.objectMap) {
+                    if (obj.second.object) {
+                        func(obj.first,
+                             static_cast<const X&>(*obj.second.object));
+                    }
+                }
+            });
+        }
+    }
+    /// call func(name, const X&) for every object of a specific type
+    template<class Func>
+    void forEachOfType(Y type, Func&& func) const
+    {
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            readTables(ii, [&func, &type](const Tables& tabs) {
+                auto names = tabs.namesByType.find(type);
+                if (names == tabs.namesByType.end()) {
+                    return;
+                }
+                for (const auto& name : names->second) {
+                    auto obj = tabs.objectMap.find(name);
+                    if (obj != tabs.objectMap.end() && obj->second.object) {
+                        func(obj->first,
+                             static_cast<const X&>(*obj->second.object));
+                    }
+                }
+            });
+        }
+    }
+    /** wait for an object with a name to be added
+    @details the wait is woken by the call adding the object
+    @return the object or nullptr if it was not added before the timeout*/
+    template<class Rep, class Period>
+    std::shared_ptr<X>
+        waitForObject(const std::string& name,
+                      const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        std::shared_ptr<X> obj;
+        std::unique_lock<std::mutex> lock(addLock);
+        // counted before the first check so an addition either is seen by
+        // the check or sees the listener
+        ++addListeners;
+        objectAdded.wait_for(lock, timeout, [&]() {
+            obj = findObject(name);
+            return static_cast<bool>(obj);
+        });
+        --addListeners;
+        return obj;
+    }
+    /** call func(obj) once an object with a name is added
+    @details if the object already exists func is called before this
+    returns, otherwise it is called by the thread adding the object.  Each
+    callback is called only once.  func is called with nullptr if the object
+    is removed again before the adding thread looks it up for the callbacks
+    @return 0 if the object already existed, otherwise an id that can be
+    passed to cancelObjectAdded*/
+    std::uint64_t onObjectAdded(const std::string& name, AddedCallback func)
+    {
+        std::shared_ptr<X> obj;
+        {
+            std::lock_guard<std::mutex> lock(addLock);
+            ++addListeners;
+            obj = findObject(name);
+            if (!obj) {
+                const auto id = ++nextCallbackId;
+                addCallbacks[name].emplace_back(id, std::move(func));
+                return id;
+            }
+            --addListeners;
+        }
+        func(obj);
+        return 0;
+    }
+    /** remove a callback registered by onObjectAdded that has not been
+    called
+    @return true if the callback was removed, false if it was already called
+    or cancelled*/
+    bool cancelObjectAdded(const std::string& name, std::uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(addLock);
+        auto fnd = addCallbacks.find(name);
+        if (fnd == addCallbacks.end()) {
+            return false;
+        }
+        auto& pending = fnd->second;
+        auto callback = std::find_if(
+            pending.begin(), pending.end(), [id](const auto& registered) {
+                return registered.first == id;
+            });
+        if (callback == pending.end()) {
+            return false;
+        }
+        pending.erase(callback);
+        if (pending.empty()) {
+            addCallbacks.erase(fnd);
+        }
+        --addListeners;
+        return true;
+    }
+    /** find an object by name through a thread local cache
+    @details the cache maps names to handles, so a hit skips the name lookup
+    and costs a hash lookup and a slot check.  A cached handle is stale once
+    its object is removed, so a hit never returns an object that has been
+    removed or replaced, and the cache holds no reference that keeps the
+    memory of a removed object alive.  Each thread caches a limited number of
+    containers and the caches of destroyed containers are dropped when a
+    thread starts caching another container*/
+    std::shared_ptr<X> findObjectCached(const std::string& name) const
+    {
+        struct ThreadCache {
+            std::weak_ptr<const char> holder;
+            std::unordered_map<std::string, ObjectHandle> handles;
+        };
+        static thread_local std::unordered_map<std::uint64_t, ThreadCache>
+            caches;
+        constexpr std::size_t maxCachedNames{1024};
+        constexpr std::size_t maxCachedHolders{16};
+
+        auto current = caches.find(holderId);
+        if (current == caches.end()) {
+            for (auto entry = caches.begin(); entry != caches.end();) {
+                entry = entry->second.holder.expired() ? caches.erase(entry) :
+                                                         std::next(entry);
+            }
+            if (caches.size() >= maxCachedHolders) {
+                caches.clear();
+            }
+            current = caches.emplace(holderId, ThreadCache{}).first;
+            current->second.holder = lifetimeToken;
+        }
+        auto& cache = current->second;
+        auto fnd = cache.handles.find(name);
+        if (fnd != cache.handles.end()) {
+            if (auto obj = findObject(fnd->second)) {
+                return obj;
+            }
+            cache.handles.erase(fnd);
+        }
+        const auto index = shardIndex(name);
+        auto lookup = [&name, index](const Tables& tabs) {
+            auto entry = tabs.objectMap.find(name);
+            if (entry == tabs.objectMap.end()) {
+                return std::make_pair(std::shared_ptr<X>(), ObjectHandle());
+            }
+            return std::make_pair(entry->second.object,
+                                  makeHandle(tabs, entry->second.slot, index));
+        };
+        auto [obj, handle] = readTables(index, lookup);
+        if (obj) {
+            if (cache.handles.size() >= maxCachedNames) {
+                cache.handles.clear();
+            }
+            cache.handles[name] = handle;
+        }
+        return obj;
+    }
+    /** get a handle for the object with a name
+    @return an invalid handle if there is no object with the name*/
+    ObjectHandle getHandle(const std::string& name) const
+    {
+        const auto index = shardIndex(name);
+        return readTables(index, [&name, index](const Tables& tabs) {
+            auto fnd = tabs.objectMap.find(name);
+            if (fnd == tabs.objectMap.end()) {
+                return ObjectHandle();
+            }
+            return makeHandle(tabs, fnd->second.slot, index);
+        });
+    }
+    /** add an object to the container and get a handle for it
+    @return an invalid handle if the name is already in use*/
+    ObjectHandle addObjectWithHandle(const std::string& name,
+                                     std::shared_ptr<X> obj)
+    {
+        const auto index = shardIndex(name);
+        if (skipWrite(index, name, true)) {
+            return ObjectHandle();
+        }
+        auto handle = writeTables(index, [&](Tables& tabs) {
+            auto res = insertObject(tabs, name, std::move(obj));
+            if (!res.second) {
+                return ObjectHandle();
+            }
+            return makeHandle(tabs, res.first->second.slot, index);
+        });
+        if (handle.isValid()) {
+            notifyAdded(name);
+        }
+        return handle;
+    }
+    /** find an object by handle
+    @return nullptr if the handle is stale or invalid*/
+    std::shared_ptr<X> findObject(ObjectHandle handle) const
+    {
+        if (handle.partition() >= shards.size()) {
+            return nullptr;
+        }
+        return readTables(
+            handle.partition(),
+            [handle](const Tables& tabs) -> std::shared_ptr<X> {
+                const auto slot = handle.slot();
+                if (slot < tabs.slots.size() &&
+                    tabs.slots[slot].generation == handle.generation()) {
+                    return tabs.slots[slot].object;
+                }
+                return nullptr;
+            });
+    }
+
+  private:
+    std::size_t shardIndex(const std::string& name) const
+    {
+        return (shards.size() == 1) ?
+            0 :
+            std::hash<std::string>{}(name) % shards.size();
+    }
+    /// get the first non null result of func over the shards
+    template<class Func>
+    std::shared_ptr<X> findInShards(Func&& func) const
+    {
+        for (std::size_t ii = 0; ii < shards.size(); ++ii) {
+            if (auto obj = readTables(ii, func)) {
+                return obj;
+            }
         }
         return nullptr;
     }
+    static ObjectHandle
+        makeHandle(const Tables& tabs, std::uint32_t slot, std::size_t index)
+    {
+        return ObjectHandle(slot,
+                            tabs.slots[slot].generation,
+                            static_cast<std::uint32_t>(index));
+    }
+    static std::vector<Y> typesOf(const Tables& tabs, const std::string& name)
+    {
+        auto fnd = tabs.typeMap.find(name);
+        return (fnd != tabs.typeMap.end()) ? fnd->second : std::vector<Y>{};
+    }
+    /// add type references for a name
+    static void
+        addTypes(Tables& tabs, const std::string& name, std::vector<Y> types)
+    {
+        if (types.empty()) {
+            return;
+        }
+        for (const auto& type : types) {
+            tabs.namesByType[type].insert(name);
+        }
+        auto& current = tabs.typeMap[name];
+        current.insert(current.end(), types.begin(), types.end());
+    }
+    /// wake the threads waiting for a newly added name
+    void notifyAdded(const std::string& name)
+    {
+        const std::string* names[] = {&name};
+        notifyAdded(names);
+    }
+    /** wake the threads waiting for a range of newly added names
+    @details this is skipped without locking if nothing is listening*/
+    template<class NameRange>
+    void notifyAdded(const NameRange& names)
+    {
+        if (addListeners.load() == 0) {
+            return;
+        }
+        std::vector<std::pair<const std::string*, AddedCallback>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(addLock);
+            if (!addCallbacks.empty()) {
+                for (const std::string* name : names) {
+                    auto fnd = addCallbacks.find(*name);
+                    if (fnd == addCallbacks.end()) {
+                        continue;
+                    }
+                    for (auto& callback : fnd->second) {
+                        callbacks.emplace_back(name,
+                                               std::move(callback.second));
+                    }
+                    addListeners -= fnd->second.size();
+                    addCallbacks.erase(fnd);
+                }
+            }
+        }
+        objectAdded.notify_all();
+        for (auto& callback : callbacks) {
+            callback.second(findObject(*callback.first));
+        }
+    }
+    /// add a range of pairs whose names are std::string
+    template<class NameObjectRange>
+    std::vector<bool> addObjectBatch(const NameObjectRange& objects)
+    {
+        std::vector<const std::decay_t<decltype(*std::begin(objects))>*> items;
+        for (const auto& element : objects) {
+            items.push_back(&element);
+        }
+        std::vector<bool> results(items.size(), false);
+        std::vector<const std::string*> addedNames;
+        // the last insertion in each shard is the hint for the next
+        std::vector<std::optional<ObjectIterator>> lastInserted(shards.size());
+        writeByShard(
+            items.size(),
+            [&items](std::size_t ii) -> const std::string& {
+                return items[ii]->first;
+            },
+            [&](Tables& tabs, std::size_t ii) {
+                const std::string& name = items[ii]->first;
+                auto& last = lastInserted[shardIndex(name)];
+                auto hint = tabs.objectMap.end();
+                if (last && (*last)->first < name) {
+                    hint = std::next(*last);
+                }
+                auto res = insertObject(tabs, hint, name, items[ii]->second);
+                if (res.second) {
+                    last = res.first;
+                    results[ii] = true;
+                    addedNames.push_back(&name);
+                }
+                return res.second;
+            });
+        if (!addedNames.empty()) {
+            notifyAdded(addedNames);
+        }
+        return results;
+    }
+    /// remove a range of std::string names
+    template<class NameRange>
+    std::vector<bool> removeObjectBatch(const NameRange& names)
+    {
+        std::vector<const std::string*> items;
+        for (const auto& name : names) {
+            items.push_back(&name);
+        }
+        std::vector<bool> results(items.size(), false);
+        writeByShard(
+            items.size(),
+            [&items](std::size_t ii) -> const std::string& {
+                return *items[ii];
+            },
+            [&items, &results](Tables& tabs, std::size_t ii) {
+                auto fnd = tabs.objectMap.find(*items[ii]);
+                if (fnd == tabs.objectMap.end()) {
+                    return false;
+                }
+                eraseObject(tabs, fnd);
+                results[ii] = true;
+                return true;
+            });
+        return results;
+    }
+    /** call action(tables, ii) for ii in [0, count) with write access to the
+    shard of each name, each shard is written once and the positions within
+    a shard are visited in order.  action returns true if it changed the
+    tables*/
+    template<class NameOf, class Action>
+    void writeByShard(std::size_t count, NameOf&& nameOf, Action&& action)
+    {
+        if (shards.size() == 1) {
+            writeTables(0, [&](Tables& tabs) {
+                bool changed{false};
+                for (std::size_t ii = 0; ii < count; ++ii) {
+                    changed = action(tabs, ii) || changed;
+                }
+                return changed;
+            });
+            return;
+        }
+        std::vector<std::vector<std::size_t>> positions(shards.size());
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            positions[shardIndex(nameOf(ii))].push_back(ii);
+        }
+        for (std::size_t jj = 0; jj < shards.size(); ++jj) {
+            if (positions[jj].empty()) {
+                continue;
+            }
+            writeTables(jj, [&](Tables& tabs) {
+                bool changed{false};
+                for (auto ii : positions[jj]) {
+                    changed = action(tabs, ii) || changed;
+                }
+                return changed;
+            });
+        }
+    }
+    /** add an object with a new name and assign it a slot
+    @return the map iterator and true if the object was inserted*/
+    static auto insertObject(Tables& tabs,
+                             const std::string& name,
+                             std::shared_ptr<X> obj)
+    {
+        auto res = tabs.objectMap.try_emplace(name);
+        if (res.second) {
+            assignSlot(tabs, res.first, std::move(obj));
+        }
+        return res;
+    }
+    /** add an object with a new name using an insertion hint
+    @return the map iterator and true if the object was inserted*/
+    static auto insertObject(Tables& tabs,
+                             ObjectIterator hint,
+                             const std::string& name,
+                             std::shared_ptr<X> obj)
+    {
+        const auto count = tabs.objectMap.size();
+        auto entry = tabs.objectMap.try_emplace(hint, name);
+        const bool inserted = (tabs.objectMap.size() != count);
+        if (inserted) {
+            assignSlot(tabs, entry, std::move(obj));
+        }
+        return std::make_pair(entry, inserted);
+    }
+    /// assign a handle slot to a newly inserted entry
+    static void
+        assignSlot(Tables& tabs, ObjectIterator entry, std::shared_ptr<X> obj)
+    {
+        std::uint32_t slot{0};
+        if (!tabs.freeSlots.empty()) {
+            slot = tabs.freeSlots.back();
+            tabs.freeSlots.pop_back();
+        } else {
+            if (tabs.slots.size() >= ObjectHandle::maxSlots) {
+                tabs.objectMap.erase(entry);
+                throw(std::length_error("too many objects for handle slots"));
+            }
+            slot = static_cast<std::uint32_t>(tabs.slots.size());
+            tabs.slots.emplace_back();
+        }
+        tabs.slots[slot].object = obj;
+        entry->second.object = std::move(obj);
+        entry->second.slot = slot;
+    }
+    /// remove an object along with its slot and type references
+    template<class Iterator>
+    static void eraseObject(Tables& tabs, Iterator entry)
+    {
+        auto& slot = tabs.slots[entry->second.slot];
+        slot.object.reset();
+        // generation 0 is reserved for invalid handles
+        if (++slot.generation == 0) {
+            slot.generation = 1;
+        }
+        tabs.freeSlots.push_back(entry->second.slot);
+        removeTypes(tabs, entry->first);
+        tabs.objectMap.erase(entry);
+    }
+    static bool hasPrefix(const std::string& name, const std::string& prefix)
+    {
+        return name.compare(0, prefix.size(), prefix) == 0;
+    }
+    /// get the first entry at or after the prefix in name order
+    static auto prefixBegin(const Tables& tabs, const std::string& prefix)
+    {
+        return tabs.objectMap.lower_bound(prefix);
+    }
+    static bool hasType(const Tables& tabs, const std::string& name, Y type)
+    {
+        auto names = tabs.namesByType.find(type);
+        return (names != tabs.namesByType.end() &&
+                names->second.find(name) != names->second.end());
+    }
+    /// remove the type references of a name from the type tables
+    static void removeTypes(Tables& tabs, const std::string& name)
+    {
+        auto fnd = tabs.typeMap.find(name);
+        if (fnd == tabs.typeMap.end()) {
+            return;
+        }
+        for (const auto& type : fnd->second) {
+            auto names = tabs.namesByType.find(type);
+            if (names != tabs.namesByType.end()) {
+                names->second.erase(name);
+                if (names->second.empty()) {
+                    tabs.namesByType.erase(names);
+                }
+            }
+        }
+        tabs.typeMap.erase(fnd);
+    }
+    /** remove the first object in a shard whose operand evaluates to true
+    in snapshot mode
+    @details the operand is evaluated once per object on the current
+    snapshot, so a shard without a match is never copied, and the write only
+    checks the matched name still holds the matched object.  The scan is
+    repeated if the object was removed or replaced in between*/
+    bool removeSnapshotMatch(
+        std::size_t index,
+        const std::function<bool(const std::shared_ptr<X>&)>& operand)
+    {
+        using Match = std::pair<std::string, std::shared_ptr<X>>;
+        while (true) {
+            auto match = readTables(
+                index, [&operand](const Tables& tabs) -> std::optional<Match> {
+                    for (const auto& obj : tabs.objectMap) {
+                        if (operand(obj.second.object)) {
+                            return Match(obj.first, obj.second.object);
+                        }
+                    }
+                    return std::nullopt;
+                });
+            if (!match) {
+                return false;
+            }
+            const bool removed = writeTables(index, [&match](Tables& tabs) {
+                auto entry = tabs.objectMap.find(match->first);
+                if (entry == tabs.objectMap.end() ||
+                    entry->second.object != match->second) {
+                    return false;
+                }
+                eraseObject(tabs, entry);
+                return true;
+            });
+            if (removed) {
+                return true;
+            }
+        }
+    }
+    /** run func on pointers to all the objects in getObjects order
+    @details the shards stay locked, or their snapshots held, until func
+    returns so the objects are not copied*/
+    template<class Func>
+    decltype(auto) searchObjects(Func&& func) const
+    {
+        std::vector<typename libguarded::cow_guarded<Tables>::shared_handle>
+            current;
+        std::vector<std::unique_lock<std::mutex>> locks;
+        std::vector<const std::shared_ptr<X>*> objs;
+        for (const auto& shard : shards) {
+            const Tables* tabs{&shard->tables};
+            if (mode == HolderMode::snapshot) {
+                current.push_back(shard->snapshotTables.lock_shared());
+                tabs = current.back().get();
+            } else {
+                locks.emplace_back(shard->mapLock);
+            }
+            objs.reserve(objs.size() + tabs->objectMap.size());
+            for (const auto& obj : tabs->objectMap) {
+                objs.push_back(&obj.second.object);
+            }
+        }
+        return func(objs);
+    }
+    /** get the executor for a parallel search
+    @details without an executor the chunks run on a pool of threads that is
+    created on first use and grown if more workers are requested*/
+    Executor searchExecutor(std::size_t workerCount,
+                            const Executor& executor) const
+    {
+        if (executor || workerCount <= 1) {
+            return executor;
+        }
+        std::lock_guard<std::mutex> lock(searchPoolLock);
+        if (searchPoolSize < workerCount - 1) {
+            searchPool = detail::makePoolExecutor(workerCount - 1);
+            searchPoolSize = workerCount - 1;
+        }
+        return searchPool;
+    }
+    /** run func with read access to the tables
+    @details in snapshot mode func runs on the current snapshot without any
+    lock*/
+    template<class Func>
+    decltype(auto) readTables(std::size_t index, Func&& func) const
+    {
+        const auto& shard = *shards[index];
+        if (mode == HolderMode::snapshot) {
+            auto current = shard.snapshotTables.lock_shared();
+            return func(*current);
+        }
+        std::lock_guard<std::mutex> lock(shard.mapLock);
+        return func(static_cast<const Tables&>(shard.tables));
+    }
+    /** run func with write access to the tables
+    @details func returns whether it changed the tables as a bool, a count,
+    or a handle.  In snapshot mode func modifies a copy of the tables which
+    is published once func returns only if something changed*/
+    template<class Func>
+    auto writeTables(std::size_t index, Func&& func)
+    {
+        auto& shard = *shards[index];
+        if (mode == HolderMode::snapshot) {
+            auto update = shard.snapshotTables.lock();
+            auto result = func(*update);
+            if (!isChange(result)) {
+                update.cancel();
+            }
+            return result;
+        }
+        std::lock_guard<std::mutex> lock(shard.mapLock);
+        return func(shard.tables);
+    }
+    static bool isChange(bool changed) { return changed; }
+    static bool isChange(std::size_t count) { return count > 0; }
+    static bool isChange(const ObjectHandle& handle)
+    {
+        return handle.isValid();
+    }
+    /** check if a name is in use
+    @details in snapshot mode every write copies the shard so this is used
+    to skip writes that would not change anything*/
+    bool hasName(std::size_t index, const std::string& name) const
+    {
+        return readTables(index, [&name](const Tables& tabs) {
+            return tabs.objectMap.find(name) != tabs.objectMap.end();
+        });
+    }
+    /// check if a write depending on whether a name is in use can be skipped
+    bool skipWrite(std::size_t index, const std::string& name, bool inUse)
+        const
+    {
+        return mode == HolderMode::snapshot && hasName(index, name) == inUse;
+    }
+    static std::uint64_t nextHolderId()
+    {
+        static std::atomic<std::uint64_t> holderCount{0};
+        return ++holderCount;
+    }
 };
 
 }  // namespace gmlc::concurrency
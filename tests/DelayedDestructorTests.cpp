@@ -5,11 +5,15 @@ for Sustainable Energy, LLC.  See the top-level NOTICE for additional details.
 All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 */
 
+#include <atomic>
 #include <future>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 /** these test cases test data_block and data_view objects
  */
 
@@ -42,3 +46,233 @@ TEST(DelayedDestrSS, basic)
     DD1.destroyObjects();
     EXPECT_EQ(DD1.size(), 0U);
 }
+
+TEST(DelayedDestr, reaper)
+{
+    std::atomic<int> deleted{0};
+    std::atomic<std::thread::id> deleteThread{};
+    DelayedDestructor<std::string> DD1([&](std::shared_ptr<std::string>&) {
+        deleteThread.store(std::this_thread::get_id());
+        ++deleted;
+    });
+    EXPECT_TRUE(DD1.startReaper(std::chrono::milliseconds(20)));
+    EXPECT_FALSE(DD1.startReaper());
+    EXPECT_TRUE(DD1.isReaperRunning());
+
+    DD1.addObjectsToBeDestroyed(std::make_shared<std::string>("test_1"));
+    int cnt = 0;
+    while (deleted.load() == 0 && cnt++ < 100) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(deleted.load(), 1);
+    EXPECT_EQ(DD1.size(), 0U);
+    EXPECT_NE(deleteThread.load(), std::this_thread::get_id());
+
+    // objects still in use are picked up on a later interval
+    auto obj = std::make_shared<std::string>("test_2");
+    DD1.addObjectsToBeDestroyed(obj);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(DD1.size(), 1U);
+    obj.reset();
+    cnt = 0;
+    while (deleted.load() == 1 && cnt++ < 100) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(deleted.load(), 2);
+    DD1.stopReaper();
+    EXPECT_FALSE(DD1.isReaperRunning());
+}
+
+TEST(DelayedDestr, reaperDrain)
+{
+    std::atomic<int> deleted{0};
+    {
+        DelayedDestructor<std::string> DD1(
+            [&](std::shared_ptr<std::string>&) { ++deleted; });
+        DD1.startReaper(std::chrono::milliseconds(500));
+        for (int ii = 0; ii < 10; ++ii) {
+            DD1.addObjectsToBeDestroyed(
+                std::make_shared<std::string>(std::to_string(ii)));
+        }
+    }
+    EXPECT_EQ(deleted.load(), 10);
+}
+
+TEST(DelayedDestr, concurrentAdd)
+{
+    std::atomic<int> deleted{0};
+    DelayedDestructor<std::string> DD1(
+        [&](std::shared_ptr<std::string>&) { ++deleted; });
+    std::atomic<bool> adding{true};
+    auto sweeper = std::async(std::launch::async, [&]() {
+        while (adding.load()) {
+            DD1.destroyObjects();
+        }
+    });
+    std::vector<std::future<void>> producers;
+    for (int ii = 0; ii < 4; ++ii) {
+        producers.push_back(std::async(std::launch::async, [&DD1, ii]() {
+            for (int jj = 0; jj < 1000; ++jj) {
+                DD1.addObjectsToBeDestroyed(std::make_shared<std::string>(
+                    std::to_string(ii * 1000 + jj)));
+            }
+        }));
+    }
+    for (auto& producer : producers) {
+        producer.get();
+    }
+    adding = false;
+    sweeper.get();
+    DD1.destroyObjects();
+    EXPECT_EQ(DD1.size(), 0U);
+    EXPECT_EQ(deleted.load(), 4000);
+}
+
+TEST(DelayedDestr, budget)
+{
+    std::atomic<int> deleted{0};
+    DelayedDestructor<std::string> DD1(
+        [&](std::shared_ptr<std::string>&) { ++deleted; });
+    auto held = std::make_shared<std::string>("held");
+    DD1.addObjectsToBeDestroyed(held);
+    for (int ii = 0; ii < 100; ++ii) {
+        DD1.addObjectsToBeDestroyed(
+            std::make_shared<std::string>(std::to_string(ii)));
+    }
+    auto remaining = DD1.destroyObjects(std::chrono::microseconds(200000), 64);
+    EXPECT_EQ(remaining, 37U);
+    EXPECT_EQ(deleted.load(), 64);
+    remaining = DD1.destroyObjects(std::chrono::microseconds(0), 64);
+    EXPECT_GE(deleted.load(), 65);
+    remaining = DD1.destroyObjects(std::chrono::microseconds(200000), 64);
+    EXPECT_EQ(remaining, 1U);
+    EXPECT_EQ(deleted.load(), 100);
+    held.reset();
+    EXPECT_EQ(DD1.destroyObjects(std::chrono::microseconds(200000), 64), 0U);
+    EXPECT_EQ(deleted.load(), 101);
+}
+
+TEST(DelayedDestr, parallel)
+{
+    std::mutex threadLock;
+    std::set<std::thread::id> threads;
+    std::atomic<int> deleted{0};
+    DelayedDestructor<std::string> DD1([&](std::shared_ptr<std::string>&) {
+        std::lock_guard<std::mutex> lock(threadLock);
+        threads.insert(std::this_thread::get_id());
+        ++deleted;
+    });
+    DD1.setParallelDestruction(100, 4);
+    for (int sweep = 0; sweep < 3; ++sweep) {
+        for (int ii = 0; ii < 1000; ++ii) {
+            DD1.addObjectsToBeDestroyed(
+                std::make_shared<std::string>(std::to_string(ii)));
+        }
+        EXPECT_EQ(DD1.destroyObjects(), 0U);
+    }
+    EXPECT_EQ(deleted.load(), 3000);
+    // the calling thread and the three pool threads are reused every sweep
+    EXPECT_GT(threads.size(), 1U);
+    EXPECT_LE(threads.size(), 4U);
+}
+
+TEST(DelayedDestr, parallelExecutor)
+{
+    std::atomic<int> deleted{0};
+    std::atomic<int> tasks{0};
+    std::vector<std::future<void>> running;
+    DelayedDestructor<std::string> DD1(
+        [&](std::shared_ptr<std::string>&) { ++deleted; });
+    DD1.setParallelDestruction(10, 3, [&](std::function<void()> task) {
+        ++tasks;
+        running.push_back(std::async(std::launch::async, std::move(task)));
+    });
+    for (int ii = 0; ii < 5; ++ii) {
+        DD1.addObjectsToBeDestroyed(
+            std::make_shared<std::string>(std::to_string(ii)));
+    }
+    DD1.destroyObjects();
+    // below the batch size so no tasks are generated
+    EXPECT_EQ(tasks.load(), 0);
+    for (int ii = 0; ii < 50; ++ii) {
+        DD1.addObjectsToBeDestroyed(
+            std::make_shared<std::string>(std::to_string(ii)));
+    }
+    DD1.destroyObjects();
+    EXPECT_EQ(tasks.load(), 2);
+    EXPECT_EQ(deleted.load(), 55);
+    EXPECT_EQ(DD1.size(), 0U);
+}
+
+TEST(DelayedDestr, statistics)
+{
+    DelayedDestructor<std::string> DD1;
+    auto held = std::make_shared<std::string>("held");
+    DD1.addObjectsToBeDestroyed(held);
+    DD1.addObjectsToBeDestroyed(std::make_shared<std::string>("test_1"));
+    DD1.addObjectsToBeDestroyed(std::make_shared<std::string>("test_2"));
+
+    auto stats = DD1.getStatistics();
+    EXPECT_EQ(stats.enqueued, 3U);
+    EXPECT_EQ(stats.destroyed, 0U);
+    EXPECT_EQ(stats.pending(), 3U);
+    EXPECT_EQ(stats.sweeps, 0U);
+
+    DD1.destroyObjects();
+    DD1.destroyObjects();
+    stats = DD1.getStatistics();
+    EXPECT_EQ(stats.destroyed, 2U);
+    EXPECT_EQ(stats.pending(), 1U);
+    EXPECT_EQ(stats.skipped, 2U);
+    EXPECT_EQ(stats.sweeps, 2U);
+    EXPECT_GE(stats.maxSweepDuration, stats.lastSweepDuration);
+    EXPECT_GE(stats.totalSweepDuration, stats.maxSweepDuration);
+    EXPECT_GE(stats.totalSweepDuration, stats.totalLockHoldTime);
+    std::uint64_t histogramTotal{0};
+    for (auto count : stats.pendingAgeHistogram) {
+        histogramTotal += count;
+    }
+    EXPECT_EQ(histogramTotal, 1U);
+
+    held.reset();
+    DD1.destroyObjects();
+    stats = DD1.getStatistics();
+    EXPECT_EQ(stats.destroyed, 3U);
+    EXPECT_EQ(stats.pending(), 0U);
+    EXPECT_EQ(stats.pendingAgeHistogram[0], 0U);
+}
+
+TEST(DelayedDestrSS, handOff)
+{
+    std::atomic<int> deleted{0};
+    std::atomic<int> wrongThread{0};
+    const auto owner = std::this_thread::get_id();
+    DelayedDestructorSingleThread<std::string> DD1(
+        [&](std::shared_ptr<std::string>&) {
+            if (std::this_thread::get_id() != owner) {
+                ++wrongThread;
+            }
+            ++deleted;
+        });
+    std::vector<std::future<void>> workers;
+    for (int ii = 0; ii < 4; ++ii) {
+        workers.push_back(std::async(std::launch::async, [&DD1]() {
+            for (int jj = 0; jj < 250; ++jj) {
+                auto obj = std::make_shared<std::string>(std::to_string(jj));
+                if (jj % 2 == 0) {
+                    DD1.addObjectsToBeDestroyed(std::move(obj));
+                } else {
+                    DD1.handOffObject(std::move(obj));
+                }
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.get();
+    }
+    DD1.addObjectsToBeDestroyed(std::make_shared<std::string>("local"));
+    EXPECT_EQ(DD1.size(), 1001U);
+    EXPECT_EQ(DD1.destroyObjects(), 0U);
+    EXPECT_EQ(deleted.load(), 1001);
+    EXPECT_EQ(wrongThread.load(), 0);
+}
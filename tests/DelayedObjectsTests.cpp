@@ -5,11 +5,16 @@ for Sustainable Energy, LLC.  See the top-level NOTICE for additional details.
 All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 */
 
+#include <atomic>
+#include <functional>
 #include <future>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <utility>
+#include <vector>
 /** these test cases test TriggerVariables
  */
 
@@ -95,3 +100,539 @@ TEST(DelayedObjects, allFulfill)
     EXPECT_EQ(fut3.get(), 19);
     EXPECT_EQ(fut4.get(), 19);
 }
+
+/** test integer keys spread across the dense and sparse storage */
+TEST(DelayedObjects, indexedKeys)
+{
+    DelayedObjects<int> objs;
+    std::vector<std::future<int>> futures;
+    // mostly increasing ids with a few far away and negative ones
+    std::vector<int> keys{10, 11, 12, 9, 5, 1000000, -40, 13, 200000};
+    for (auto key : keys) {
+        futures.push_back(objs.getFuture(key));
+    }
+    for (auto key : keys) {
+        EXPECT_TRUE(objs.isRecognized(key));
+        EXPECT_FALSE(objs.isCompleted(key));
+    }
+    EXPECT_FALSE(objs.isRecognized(8));
+    EXPECT_FALSE(objs.isRecognized(14));
+    for (auto key : keys) {
+        objs.setDelayedValue(key, key * 2);
+    }
+    for (std::size_t ii = 0; ii < keys.size(); ++ii) {
+        EXPECT_EQ(futures[ii].get(), keys[ii] * 2);
+        EXPECT_TRUE(objs.isCompleted(keys[ii]));
+        objs.finishedWithValue(keys[ii]);
+        EXPECT_FALSE(objs.isRecognized(keys[ii]));
+    }
+}
+
+/** test that slots are recycled as request ids advance */
+TEST(DelayedObjects, slotRecycling)
+{
+    DelayedObjects<int> objs;
+    for (int ii = 0; ii < 70000; ++ii) {
+        auto fut = objs.getFuture(ii);
+        objs.setDelayedValue(ii, ii);
+        ASSERT_EQ(fut.get(), ii);
+        objs.finishedWithValue(ii);
+    }
+    EXPECT_FALSE(objs.isRecognized(69999));
+    // an unfulfilled request does not prevent later ids being stored
+    auto fut1 = objs.getFuture(5);
+    auto fut2 = objs.getFuture(5 + 100000);
+    objs.setDelayedValue(5 + 100000, 7);
+    EXPECT_EQ(fut2.get(), 7);
+    objs.finishedWithValue(5 + 100000);
+    EXPECT_TRUE(objs.isRecognized(5));
+    EXPECT_FALSE(objs.isCompleted(5));
+}
+
+TEST(DelayedObjects, slotTable)
+{
+    detail::IndexedSlotTable<int> table;
+    EXPECT_TRUE(table.empty());
+    for (int ii = 0; ii < 100; ++ii) {
+        *table.emplace(ii).first = ii;
+    }
+    EXPECT_FALSE(table.emplace(50).second);
+    EXPECT_EQ(table.size(), 100U);
+    for (int ii = 0; ii < 50; ++ii) {
+        EXPECT_TRUE(table.erase(ii));
+    }
+    EXPECT_FALSE(table.erase(10));
+    *table.emplace(-1000000).first = 5;
+    int total{0};
+    table.forEach([&total](int key, int& value) {
+        EXPECT_EQ((key >= 0) ? key : 5, value);
+        ++total;
+    });
+    EXPECT_EQ(total, 51);
+    ASSERT_NE(table.find(-1000000), nullptr);
+    EXPECT_EQ(table.find(10), nullptr);
+}
+
+TEST(DelayedObjects, oneShot)
+{
+    DelayedObjects<std::string> objs;
+    auto fut = objs.getOneShotFuture(1);
+    auto fut2 = objs.getOneShotFuture("string");
+    EXPECT_FALSE(fut.is_ready());
+    std::thread setter([&objs]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        objs.setDelayedValue(1, "one");
+        objs.setDelayedValue("string", "two");
+    });
+    EXPECT_EQ(fut.get(), "one");
+    EXPECT_EQ(fut2.get(), "two");
+    setter.join();
+    EXPECT_TRUE(objs.isCompleted(1));
+    objs.finishedWithValue(1);
+    objs.finishedWithValue("string");
+    EXPECT_FALSE(objs.isRecognized(1));
+    // the value remains accessible through the handle
+    EXPECT_EQ(fut.get(), "one");
+
+    // slots are reused from the pool whichever side releases them last
+    const std::string* slot{nullptr};
+    for (int ii = 0; ii < 100; ++ii) {
+        auto next = objs.getOneShotFuture(ii);
+        objs.setDelayedValue(ii, std::to_string(ii));
+        EXPECT_EQ(next.get(), std::to_string(ii));
+        if (slot == nullptr) {
+            slot = &next.get();
+        }
+        EXPECT_EQ(&next.get(), slot);
+        objs.finishedWithValue(ii);
+    }
+    for (int ii = 0; ii < 100; ++ii) {
+        auto next = objs.getOneShotFuture(ii);
+        objs.setDelayedValue(ii, std::to_string(ii));
+        objs.finishedWithValue(ii);
+        EXPECT_EQ(next.get(), std::to_string(ii));
+        EXPECT_EQ(&next.get(), slot);
+    }
+}
+
+TEST(DelayedObjects, oneShotDefault)
+{
+    OneShotFuture<int> fut3;
+    EXPECT_FALSE(fut3.valid());
+    {
+        DelayedObjects<int> objs;
+        auto fut = objs.getOneShotFuture(1);
+        // replacing the request releases the first with a default value
+        auto fut2 = objs.getOneShotFuture(1);
+        EXPECT_EQ(fut.wait_for(std::chrono::milliseconds(0)),
+                  std::future_status::ready);
+        EXPECT_EQ(fut.get(), 0);
+        EXPECT_EQ(fut2.wait_for(std::chrono::milliseconds(5)),
+                  std::future_status::timeout);
+        fut3 = std::move(fut2);
+    }
+    EXPECT_TRUE(fut3.is_ready());
+    EXPECT_EQ(fut3.get(), 0);
+}
+
+TEST(DelayedObjects, sharded)
+{
+    DelayedObjects<int> objs(8);
+    EXPECT_EQ(objs.shardCount(), 8U);
+    std::vector<std::future<int>> futures;
+    for (int ii = -20; ii < 200; ++ii) {
+        futures.push_back(objs.getFuture(ii));
+    }
+    auto sfut = objs.getFuture("name");
+    std::vector<std::thread> setters;
+    for (int jj = 0; jj < 4; ++jj) {
+        setters.emplace_back([&objs, jj]() {
+            for (int ii = -20 + jj; ii < 200; ii += 4) {
+                objs.setDelayedValue(ii, ii * 3);
+            }
+        });
+    }
+    for (auto& setter : setters) {
+        setter.join();
+    }
+    for (int ii = -20; ii < 200; ++ii) {
+        EXPECT_EQ(futures[ii + 20].get(), ii * 3);
+        EXPECT_TRUE(objs.isCompleted(ii));
+        objs.finishedWithValue(ii);
+        EXPECT_FALSE(objs.isRecognized(ii));
+    }
+    EXPECT_TRUE(objs.isRecognized("name"));
+    EXPECT_FALSE(objs.isCompleted("name"));
+    auto ifut = objs.getFuture(1001);
+    objs.fulfillAllPromises(9);
+    EXPECT_EQ(sfut.get(), 9);
+    EXPECT_EQ(ifut.get(), 9);
+}
+
+TEST(DelayedObjects, slotTableStride)
+{
+    detail::IndexedSlotTable<int> table(4, 3);
+    for (int ii = -9; ii < 40; ii += 4) {
+        *table.emplace(ii).first = ii;
+    }
+    EXPECT_EQ(table.size(), 13U);
+    table.forEach([](int key, int& value) { EXPECT_EQ(key, value); });
+    EXPECT_TRUE(table.erase(-9));
+    ASSERT_NE(table.find(39), nullptr);
+    EXPECT_EQ(*table.find(39), 39);
+}
+
+TEST(DelayedObjects, batch)
+{
+    for (std::size_t shardCount : {1U, 4U}) {
+        DelayedObjects<int> objs(shardCount);
+        std::vector<int> keys{5, 1, 9, 2, 14, 3};
+        auto futures = objs.getFutures(keys);
+        ASSERT_EQ(futures.size(), keys.size());
+        std::vector<std::pair<int, int>> values{
+            {9, 90}, {7, 70}, {1, 10}, {14, 140}, {5, 50}};
+        auto results = objs.setDelayedValues(values);
+        EXPECT_EQ(results, (std::vector<bool>{true, false, true, true, true}));
+        // already completed values are not set again
+        results = objs.setDelayedValues(values);
+        EXPECT_EQ(results, std::vector<bool>(5, false));
+        EXPECT_EQ(futures[0].get(), 50);
+        EXPECT_EQ(futures[1].get(), 10);
+        EXPECT_EQ(futures[2].get(), 90);
+        EXPECT_EQ(futures[4].get(), 140);
+        EXPECT_FALSE(objs.isCompleted(2));
+        EXPECT_FALSE(objs.isRecognized(7));
+
+        std::vector<std::string> names{"a", "b", "c"};
+        auto nfutures = objs.getFutures(names);
+        std::vector<std::pair<std::string, int>> nvalues{{"c", 3}, {"a", 1}};
+        results = objs.setDelayedValues(nvalues);
+        EXPECT_EQ(results, (std::vector<bool>{true, true}));
+        EXPECT_EQ(nfutures[0].get(), 1);
+        EXPECT_EQ(nfutures[2].get(), 3);
+        EXPECT_FALSE(objs.isCompleted("b"));
+    }
+}
+
+TEST(DelayedObjects, continuation)
+{
+    std::atomic<int> total{0};
+    {
+        DelayedObjects<int> objs(2);
+        EXPECT_FALSE(objs.getContinuation(1, [&total](int val) {
+            total += val;
+        }));
+        EXPECT_FALSE(objs.getContinuation(1, [&total](int val) {
+            total += val * 10;
+        }));
+        EXPECT_FALSE(objs.getContinuation("name", [&total](int val) {
+            total += val * 100;
+        }));
+        EXPECT_TRUE(objs.isRecognized(1));
+        EXPECT_FALSE(objs.isCompleted(1));
+        objs.setDelayedValue(1, 2);
+        EXPECT_EQ(total.load(), 22);
+        // the value is already there so the call runs immediately
+        EXPECT_TRUE(objs.getContinuation(1, [&total](int val) {
+            total += val * 1000;
+        }));
+        EXPECT_EQ(total.load(), 2022);
+        objs.setDelayedValues(std::vector<std::pair<std::string, int>>{
+            {"name", 3}});
+        EXPECT_EQ(total.load(), 2322);
+        objs.getContinuation(5, [&total](int val) { total += val + 1; });
+        objs.fulfillAllPromises(4);
+        EXPECT_EQ(total.load(), 2327);
+        // outstanding continuations get a default value on destruction
+        objs.getContinuation(6, [&total](int val) { total += val + 10; });
+    }
+    EXPECT_EQ(total.load(), 2337);
+}
+
+TEST(DelayedObjects, lateContinuation)
+{
+    DelayedObjects<std::string> objs;
+    std::string result;
+    // with the default retention a completed key runs the call immediately
+    auto fut = objs.getFuture("early");
+    objs.setDelayedValue("early", "value");
+    EXPECT_EQ(fut.get(), "value");
+    EXPECT_TRUE(objs.getContinuation(
+        "early", [&result](const std::string& val) { result = val; }));
+    EXPECT_EQ(result, "value");
+
+    objs.setLateContinuations(false);
+    auto fut2 = objs.getFuture("late");
+    objs.setDelayedValue("late", "value2");
+    EXPECT_EQ(fut2.get(), "value2");
+    EXPECT_THROW(objs.getContinuation("late", [](const std::string&) {}),
+                 std::logic_error);
+    // one shot slots keep the value without a copy
+    auto oneShot = objs.getOneShotFuture("slot");
+    objs.setDelayedValue("slot", "value3");
+    EXPECT_TRUE(objs.getContinuation(
+        "slot", [&result](const std::string& val) { result = val; }));
+    EXPECT_EQ(result, "value3");
+    EXPECT_EQ(oneShot.get(), "value3");
+}
+
+TEST(DelayedObjects, moveOnly)
+{
+    DelayedObjects<std::unique_ptr<int>> objs;
+    auto fut = objs.getFuture(1);
+    auto oneShot = objs.getOneShotFuture("name");
+    objs.setDelayedValue(1, std::make_unique<int>(5));
+    objs.setDelayedValue("name", std::make_unique<int>(7));
+    auto val = fut.get();
+    ASSERT_TRUE(val);
+    EXPECT_EQ(*val, 5);
+    ASSERT_TRUE(oneShot.get());
+    EXPECT_EQ(*oneShot.get(), 7);
+    objs.finishedWithValue(1);
+    objs.finishedWithValue("name");
+}
+
+TEST(DelayedObjects, continuationExecutor)
+{
+    DelayedObjects<std::string> objs;
+    std::vector<std::function<void()>> queued;
+    objs.setContinuationExecutor(
+        [&queued](std::function<void()> task) {
+            queued.push_back(std::move(task));
+        });
+    std::string result;
+    objs.getContinuation("key", [&result](const std::string& val) {
+        result = val;
+    });
+    objs.setDelayedValue("key", "value");
+    EXPECT_TRUE(result.empty());
+    ASSERT_EQ(queued.size(), 1U);
+    objs.finishedWithValue("key");
+    queued.front()();
+    EXPECT_EQ(result, "value");
+}
+
+TEST(DelayedObjects, heterogeneousKeys)
+{
+    DelayedObjectTable<int, std::string> objs(4);
+    auto fut = objs.getFuture(std::string_view("alpha"));
+    const char* beta = "beta";
+    auto fut2 = objs.getFuture(beta);
+    const std::string name{"alpha"};
+    EXPECT_TRUE(objs.isRecognized(name));
+    EXPECT_TRUE(objs.isRecognized("beta"));
+    EXPECT_FALSE(objs.isRecognized(std::string_view("gamma")));
+    objs.setDelayedValue(std::string_view("alpha"), 1);
+    objs.setDelayedValue("beta", 2);
+    EXPECT_EQ(fut.get(), 1);
+    EXPECT_EQ(fut2.get(), 2);
+    objs.finishedWithValue(std::string_view("alpha"));
+    EXPECT_FALSE(objs.isRecognized("alpha"));
+    EXPECT_TRUE(objs.isCompleted(std::string_view("beta")));
+}
+
+namespace {
+struct RequestKey {
+    int source;
+    int id;
+    bool operator<(const RequestKey& other) const
+    {
+        return (source != other.source) ? source < other.source :
+                                          id < other.id;
+    }
+};
+struct RequestKeyHash {
+    std::size_t operator()(const RequestKey& key) const
+    {
+        return std::hash<int>{}(key.source * 31 + key.id);
+    }
+};
+}  // namespace
+
+TEST(DelayedObjects, customKey)
+{
+    DelayedObjectTable<double, RequestKey, RequestKeyHash> objs(3);
+    std::vector<RequestKey> keys{{1, 1}, {1, 2}, {2, 1}};
+    auto futures = objs.getFutures(keys);
+    objs.setDelayedValue(RequestKey{2, 1}, 2.5);
+    objs.setDelayedValue(RequestKey{1, 2}, 1.5);
+    objs.setDelayedValue(RequestKey{1, 1}, 0.5);
+    EXPECT_DOUBLE_EQ(futures[0].get(), 0.5);
+    EXPECT_DOUBLE_EQ(futures[1].get(), 1.5);
+    EXPECT_DOUBLE_EQ(futures[2].get(), 2.5);
+    EXPECT_FALSE(objs.isRecognized(RequestKey{2, 2}));
+}
+
+TEST(DelayedObjects, retentionFifo)
+{
+    DelayedObjects<int> objs;
+    objs.setCompletedRetention(3);
+    std::vector<std::future<int>> futures;
+    for (int ii = 0; ii < 10; ++ii) {
+        futures.push_back(objs.getFuture(ii));
+    }
+    for (int ii = 0; ii < 10; ++ii) {
+        objs.setDelayedValue(ii, ii);
+    }
+    EXPECT_EQ(objs.evictedCount(), 7U);
+    for (int ii = 0; ii < 7; ++ii) {
+        // evicted keys are forgotten but the futures still have their values
+        EXPECT_FALSE(objs.isRecognized(ii));
+        EXPECT_FALSE(objs.isCompleted(ii));
+        EXPECT_EQ(futures[ii].get(), ii);
+    }
+    for (int ii = 7; ii < 10; ++ii) {
+        EXPECT_TRUE(objs.isCompleted(ii));
+    }
+    // finishing a value frees space for the next one
+    objs.finishedWithValue(7);
+    auto fut = objs.getFuture(20);
+    objs.setDelayedValue(20, 4);
+    EXPECT_EQ(objs.evictedCount(), 7U);
+    EXPECT_TRUE(objs.isCompleted(8));
+    EXPECT_TRUE(objs.isCompleted(20));
+}
+
+TEST(DelayedObjects, retentionLru)
+{
+    DelayedObjectTable<int, std::string> objs;
+    objs.setCompletedRetention(2, EvictionOrder::lru);
+    auto fut1 = objs.getFuture("a");
+    auto fut2 = objs.getFuture("b");
+    auto fut3 = objs.getFuture("c");
+    objs.setDelayedValue("a", 1);
+    objs.setDelayedValue("b", 2);
+    // accessing "a" makes "b" the least recently used
+    EXPECT_TRUE(objs.isCompleted("a"));
+    objs.setDelayedValue("c", 3);
+    EXPECT_EQ(objs.evictedCount(), 1U);
+    EXPECT_TRUE(objs.isCompleted("a"));
+    EXPECT_FALSE(objs.isRecognized("b"));
+    EXPECT_TRUE(objs.isCompleted("c"));
+    // unfulfilled requests are never evicted
+    for (int ii = 0; ii < 10; ++ii) {
+        objs.getFuture(std::to_string(ii));
+    }
+    EXPECT_TRUE(objs.isRecognized("0"));
+    EXPECT_EQ(objs.evictedCount(), 1U);
+}
+
+TEST(DelayedObjects, retentionShardedLimit)
+{
+    DelayedObjects<int> objs(4);
+    objs.setCompletedRetention(6, EvictionOrder::lru);
+    std::vector<std::future<int>> futures;
+    for (int ii = 0; ii < 40; ++ii) {
+        futures.push_back(objs.getFuture(ii));
+    }
+    for (int ii = 0; ii < 40; ++ii) {
+        objs.setDelayedValue(ii, ii);
+        // repeated access reorders the records without adding to them
+        EXPECT_TRUE(objs.isCompleted(ii));
+        EXPECT_TRUE(objs.isCompleted(ii));
+    }
+    int retained{0};
+    for (int ii = 0; ii < 40; ++ii) {
+        if (objs.isCompleted(ii)) {
+            ++retained;
+        }
+    }
+    // the limit is split over the shards without rounding up
+    EXPECT_EQ(retained, 6);
+    EXPECT_EQ(objs.evictedCount(), 34U);
+}
+
+TEST(DelayedObjects, retentionTimeToLive)
+{
+    DelayedObjects<int> objs(2);
+    objs.setCompletedRetention(DelayedObjectTable<int, int>::maxShards * 100,
+                               EvictionOrder::fifo,
+                               std::chrono::milliseconds(20));
+    auto fut = objs.getFuture(1);
+    auto fut2 = objs.getFuture(2);
+    objs.setDelayedValue(1, 1);
+    objs.setDelayedValue(2, 2);
+    objs.evictExpired();
+    EXPECT_TRUE(objs.isCompleted(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    objs.evictExpired();
+    EXPECT_FALSE(objs.isRecognized(1));
+    EXPECT_FALSE(objs.isRecognized(2));
+    EXPECT_EQ(objs.evictedCount(), 2U);
+}
+
+TEST(DelayedObjects, waitAny)
+{
+    DelayedObjects<int> objs(2);
+    std::vector<int> keys{1, 2, 3};
+    auto futures = objs.getFutures(keys);
+    auto result = objs.wait_any(keys, std::chrono::milliseconds(10));
+    EXPECT_FALSE(result.has_value());
+    std::thread setter([&objs]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        objs.setDelayedValue(2, 20);
+    });
+    result = objs.wait_any(keys, std::chrono::seconds(5));
+    setter.join();
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(*result, 2);
+    // an already completed key returns immediately
+    result = objs.wait_any(std::vector<int>{7, 3, 2}, std::chrono::seconds(5));
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(*result, 2);
+
+    auto nfut = objs.getFuture("name");
+    objs.setDelayedValue("name", 3);
+    auto nresult = objs.wait_any(std::vector<std::string>{"name"},
+                                 std::chrono::milliseconds(0));
+    ASSERT_TRUE(nresult.has_value());
+    EXPECT_EQ(*nresult, "name");
+
+    // keys that are not recognized can never complete so there is no wait
+    const auto start = std::chrono::steady_clock::now();
+    result = objs.wait_any(std::vector<int>{100, 101}, std::chrono::seconds(5));
+    EXPECT_FALSE(result.has_value());
+    DelayedCompletionQueue<int> queue;
+    objs.watchCompletions(std::vector<int>{100, 101}, queue);
+    EXPECT_FALSE(queue.pop(std::chrono::seconds(5)).has_value());
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(1));
+}
+
+TEST(DelayedObjects, completionQueue)
+{
+    DelayedObjects<int> objs;
+    std::vector<int> keys{1, 2, 3, 4};
+    auto futures = objs.getFutures(keys);
+    objs.setDelayedValue(4, 4);
+    DelayedCompletionQueue<int> queue;
+    objs.watchCompletions(keys, queue);
+    EXPECT_EQ(queue.size(), 1U);
+    objs.setDelayedValue(3, 3);
+    objs.setDelayedValue(1, 1);
+    EXPECT_EQ(queue.tryPop(), 4);
+    EXPECT_EQ(queue.tryPop(), 3);
+    EXPECT_EQ(queue.tryPop(), 1);
+    EXPECT_FALSE(queue.tryPop().has_value());
+    std::thread setter([&objs]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        objs.setDelayedValue(2, 2);
+    });
+    EXPECT_EQ(queue.pop(std::chrono::seconds(5)), 2);
+    setter.join();
+    EXPECT_TRUE(queue.empty());
+    {
+        // a queue can be destroyed while it is still watching keys
+        DelayedCompletionQueue<int> shortQueue;
+        auto fut = objs.getFuture(10);
+        objs.watchCompletions(std::vector<int>{10}, shortQueue);
+    }
+    objs.setDelayedValue(10, 10);
+    EXPECT_TRUE(objs.isCompleted(10));
+
+    // once the watched keys are delivered pop does not wait
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(queue.pop(std::chrono::seconds(5)).has_value());
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(1));
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2017-2023,
+Battelle Memorial Institute; Lawrence Livermore National Security, LLC; Alliance
+for Sustainable Energy, LLC.  See the top-level NOTICE for additional details.
+All rights reserved. SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+/** these test cases test the epoch based destructor
+ */
+
+#include "concurrency/EpochDestructor.hpp"
+
+#include "gtest/gtest.h"
+#include <iostream>
+
+using namespace gmlc::concurrency;
+
+/** test basic operations */
+TEST(EpochDestr, basic)
+{
+    EpochDestructor<std::string> ED1;
+    ED1.retire(std::make_unique<std::string>("test_1"));
+    ED1.retire(new std::string("test_2"));
+    ED1.retire(std::make_shared<std::string>("test_3"));
+
+    EXPECT_EQ(ED1.size(), 3U);
+    // no participants so everything can be destroyed
+    EXPECT_EQ(ED1.destroyObjects(), 0U);
+    EXPECT_EQ(ED1.size(), 0U);
+}
+
+TEST(EpochDestr, quiescent)
+{
+    std::atomic<int> deleted{0};
+    EpochDestructor<std::string> ED1([&](std::string*) { ++deleted; });
+    auto& reader1 = ED1.registerThread();
+    auto& reader2 = ED1.registerThread();
+
+    ED1.retire(new std::string("test_1"));
+    EXPECT_EQ(ED1.destroyObjects(), 1U);
+    reader1.quiescent();
+    EXPECT_EQ(ED1.destroyObjects(), 1U);
+    reader2.quiescent();
+    EXPECT_EQ(ED1.destroyObjects(), 0U);
+    EXPECT_EQ(deleted.load(), 1);
+
+    ED1.retire(new std::string("test_2"));
+    reader1.quiescent();
+    ED1.retire(new std::string("test_3"));
+    // reader2 holds up both
+    EXPECT_EQ(ED1.destroyObjects(), 2U);
+    reader2.goOffline();
+    // reader1 has only passed the first retirement
+    EXPECT_EQ(ED1.destroyObjects(), 1U);
+    EXPECT_EQ(deleted.load(), 2);
+    ED1.unregisterThread(reader1);
+    EXPECT_EQ(ED1.destroyObjects(), 0U);
+    EXPECT_EQ(deleted.load(), 3);
+    reader2.goOnline();
+    EXPECT_TRUE(reader2.isOnline());
+    ED1.unregisterThread(reader2);
+}
+
+TEST(EpochDestr, threaded)
+{
+    EpochDestructor<std::string> ED1;
+    std::atomic<std::string*> current{new std::string("start")};
+    std::atomic<bool> running{true};
+    std::atomic<bool> started{false};
+    auto reader = std::async(std::launch::async, [&]() {
+        auto& participant = ED1.registerThread();
+        started = true;
+        std::size_t length{0};
+        while (running.load()) {
+            length += current.load()->size();
+            participant.quiescent();
+        }
+        ED1.unregisterThread(participant);
+        return length;
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+    for (int ii = 0; ii < 1000; ++ii) {
+        auto* old = current.exchange(new std::string(std::to_string(ii)));
+        ED1.retire(old);
+        ED1.destroyObjects();
+    }
+    // make sure the reader gets through at least one full read
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    running = false;
+    EXPECT_GT(reader.get(), 0U);
+    ED1.retire(current.load());
+    EXPECT_EQ(ED1.destroyObjects(), 0U);
+}
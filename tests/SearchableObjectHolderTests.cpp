@@ -5,6 +5,7 @@ for Sustainable Energy, LLC.  See the top-level NOTICE for additional details.
 All rights reserved. SPDX-License-Identifier: BSD-3-Clause
 */
 
+#include <atomic>
 #include <future>
 #include <memory>
 #include <string>
@@ -69,3 +70,508 @@ TEST(SOH, containedType)
 
     objects.clear();
 }
+
+TEST(SOH, snapshot)
+{
+    SearchableObjectHolder<std::string, char> SOH1(HolderMode::snapshot);
+    EXPECT_EQ(SOH1.getMode(), HolderMode::snapshot);
+    EXPECT_TRUE(SOH1.addObject(
+        "test1", std::make_shared<std::string>("test_1"), '1'));
+    EXPECT_FALSE(SOH1.addObject("test1", std::make_shared<std::string>("x")));
+    SOH1.addType("test1", '2');
+    EXPECT_TRUE(SOH1.copyObject("test1", "test2"));
+    EXPECT_TRUE(SOH1.checkObjectType("test2", '2'));
+    auto found = SOH1.findObject(
+        [](const std::shared_ptr<std::string>& obj) {
+            return *obj == "test_1";
+        },
+        '1');
+    ASSERT_TRUE(found);
+    EXPECT_EQ(*found, "test_1");
+
+    std::atomic<bool> done{false};
+    std::atomic<int> misses{0};
+    std::thread reader([&]() {
+        while (!done.load()) {
+            if (!SOH1.findObject("test1")) {
+                ++misses;
+            }
+        }
+    });
+    for (int ii = 0; ii < 200; ++ii) {
+        SOH1.addObject("obj" + std::to_string(ii),
+                       std::make_shared<std::string>(std::to_string(ii)));
+    }
+    done.store(true);
+    reader.join();
+    EXPECT_EQ(misses.load(), 0);
+    EXPECT_EQ(SOH1.getObjects().size(), 202U);
+    for (int ii = 0; ii < 200; ++ii) {
+        EXPECT_TRUE(SOH1.removeObject("obj" + std::to_string(ii)));
+    }
+    // the predicate is evaluated once per object up to the match
+    int checks{0};
+    EXPECT_TRUE(SOH1.removeObject(
+        [&checks](const std::shared_ptr<std::string>& obj) {
+            ++checks;
+            return *obj == "test_1";
+        }));
+    EXPECT_EQ(checks, 1);
+    EXPECT_TRUE(SOH1.removeObject("test2"));
+    EXPECT_TRUE(SOH1.empty());
+    EXPECT_FALSE(SOH1.checkObjectType("test2", '2'));
+}
+
+TEST(SOH, typeIndex)
+{
+    SearchableObjectHolder<std::string, char> SOH1;
+    for (int ii = 0; ii < 30; ++ii) {
+        SOH1.addObject("obj" + std::to_string(ii),
+                       std::make_shared<std::string>(std::to_string(ii)),
+                       static_cast<char>('a' + ii % 3));
+    }
+    SOH1.addType("obj1", 'c');
+    EXPECT_EQ(SOH1.getObjectsOfType('a').size(), 10U);
+    EXPECT_EQ(SOH1.getObjectsOfType('c').size(), 11U);
+    EXPECT_TRUE(SOH1.getObjectsOfType('z').empty());
+    EXPECT_TRUE(SOH1.checkObjectType("obj1", 'b'));
+    EXPECT_TRUE(SOH1.checkObjectType("obj1", 'c'));
+    EXPECT_FALSE(SOH1.checkObjectType("obj1", 'a'));
+
+    auto isOne = [](const std::shared_ptr<std::string>& obj) {
+        return *obj == "1";
+    };
+    EXPECT_TRUE(SOH1.findObject(isOne, 'c'));
+    EXPECT_FALSE(SOH1.findObject(isOne, 'a'));
+
+    EXPECT_TRUE(SOH1.copyObject("obj1", "copy1"));
+    EXPECT_EQ(SOH1.getObjectsOfType('c').size(), 12U);
+    EXPECT_TRUE(SOH1.removeObject("obj1"));
+    EXPECT_FALSE(SOH1.checkObjectType("obj1", 'c'));
+    EXPECT_TRUE(SOH1.checkObjectType("copy1", 'c'));
+    EXPECT_EQ(SOH1.getObjectsOfType('b').size(), 10U);
+    EXPECT_TRUE(SOH1.removeObject(isOne));
+    EXPECT_FALSE(SOH1.checkObjectType("copy1", 'c'));
+    EXPECT_EQ(SOH1.getObjectsOfType('c').size(), 10U);
+    for (int ii = 0; ii < 30; ++ii) {
+        SOH1.removeObject("obj" + std::to_string(ii));
+    }
+    EXPECT_TRUE(SOH1.getObjectsOfType('a').empty());
+
+    // types given before the object is added are kept and the index agrees
+    SOH1.addType("late", '1');
+    EXPECT_TRUE(SOH1.addObject(
+        "late", std::make_shared<std::string>("late"), '2'));
+    EXPECT_TRUE(SOH1.checkObjectType("late", '1'));
+    EXPECT_FALSE(SOH1.checkObjectType("late", '2'));
+    EXPECT_TRUE(SOH1.getObjectsOfType('2').empty());
+    EXPECT_TRUE(SOH1.removeObject("late"));
+    SOH1.addObject("late", std::make_shared<std::string>("again"));
+    EXPECT_TRUE(SOH1.getObjectsOfType('1').empty());
+    EXPECT_TRUE(SOH1.getObjectsOfType('2').empty());
+    SOH1.removeObject("late");
+}
+
+TEST(SOH, handles)
+{
+    for (auto mode : {HolderMode::locking, HolderMode::snapshot}) {
+        SearchableObjectHolder<std::string> SOH1(mode);
+        auto handle1 = SOH1.addObjectWithHandle(
+            "fed1/interface1", std::make_shared<std::string>("one"));
+        ASSERT_TRUE(handle1.isValid());
+        EXPECT_FALSE(SOH1.addObjectWithHandle(
+                             "fed1/interface1",
+                             std::make_shared<std::string>("again"))
+                         .isValid());
+        SOH1.addObject("fed1/interface2", std::make_shared<std::string>("two"));
+        auto handle2 = SOH1.getHandle("fed1/interface2");
+        ASSERT_TRUE(handle2.isValid());
+        EXPECT_NE(handle1, handle2);
+        EXPECT_EQ(handle1, SOH1.getHandle("fed1/interface1"));
+        EXPECT_FALSE(SOH1.getHandle("missing").isValid());
+        EXPECT_EQ(*SOH1.findObject(handle1), "one");
+        EXPECT_EQ(*SOH1.findObject(handle2), "two");
+        EXPECT_FALSE(SOH1.findObject(ObjectHandle()));
+
+        // a removed object's handle is stale even after its slot is reused
+        SOH1.removeObject("fed1/interface1");
+        EXPECT_FALSE(SOH1.findObject(handle1));
+        auto handle3 = SOH1.addObjectWithHandle(
+            "fed1/interface3", std::make_shared<std::string>("three"));
+        EXPECT_EQ(handle3.slot(), handle1.slot());
+        EXPECT_FALSE(SOH1.findObject(handle1));
+        EXPECT_EQ(*SOH1.findObject(handle3), "three");
+        SOH1.removeObject("fed1/interface2");
+        SOH1.removeObject("fed1/interface3");
+    }
+}
+
+/// allocator counting deallocations to check when memory is released
+template<class T>
+struct CountingAllocator {
+    using value_type = T;
+    explicit CountingAllocator(std::atomic<int>* counter): frees(counter) {}
+    template<class U>
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    CountingAllocator(const CountingAllocator<U>& other):
+        frees(other.frees)
+    {
+    }
+    T* allocate(std::size_t count)
+    {
+        return std::allocator<T>{}.allocate(count);
+    }
+    void deallocate(T* ptr, std::size_t count)
+    {
+        ++*frees;
+        std::allocator<T>{}.deallocate(ptr, count);
+    }
+    template<class U>
+    bool operator==(const CountingAllocator<U>& other) const
+    {
+        return frees == other.frees;
+    }
+    template<class U>
+    bool operator!=(const CountingAllocator<U>& other) const
+    {
+        return frees != other.frees;
+    }
+    std::atomic<int>* frees;
+};
+
+TEST(SOH, cachedLookup)
+{
+    SearchableObjectHolder<std::string> SOH1;
+    SOH1.addObject("test1", std::make_shared<std::string>("test_1"));
+    auto res = SOH1.findObjectCached("test1");
+    ASSERT_TRUE(res);
+    EXPECT_EQ(*res, "test_1");
+    EXPECT_EQ(SOH1.findObjectCached("test1"), res);
+    EXPECT_FALSE(SOH1.findObjectCached("test2"));
+
+    // a replaced object is not served from the cache
+    SOH1.removeObject("test1");
+    EXPECT_FALSE(SOH1.findObjectCached("test1"));
+    SOH1.addObject("test1", std::make_shared<std::string>("new_1"));
+    EXPECT_EQ(*SOH1.findObjectCached("test1"), "new_1");
+
+    std::thread other([&SOH1]() {
+        auto obj = SOH1.findObjectCached("test1");
+        ASSERT_TRUE(obj);
+        EXPECT_EQ(*obj, "new_1");
+    });
+    other.join();
+    {
+        // each container has its own cache
+        SearchableObjectHolder<std::string> SOH2;
+        SOH2.addObject("test1", std::make_shared<std::string>("other"));
+        EXPECT_EQ(*SOH2.findObjectCached("test1"), "other");
+        EXPECT_EQ(*SOH1.findObjectCached("test1"), "new_1");
+        SOH2.removeObject("test1");
+    }
+    SOH1.removeObject("test1");
+
+    // the cache of a destroyed container does not pin its objects memory
+    std::atomic<int> freed{0};
+    {
+        SearchableObjectHolder<std::string> SOH2;
+        SOH2.addObject("test1",
+                       std::allocate_shared<std::string>(
+                           CountingAllocator<std::string>(&freed), "test_1"));
+        EXPECT_TRUE(SOH2.findObjectCached("test1"));
+        SOH2.removeObject("test1");
+    }
+    SearchableObjectHolder<std::string> SOH3;
+    EXPECT_FALSE(SOH3.findObjectCached("test1"));
+    EXPECT_EQ(freed.load(), 1);
+
+    // nor does the cache of a live container once the object is removed
+    SOH3.addObject("test1",
+                   std::allocate_shared<std::string>(
+                       CountingAllocator<std::string>(&freed), "test_1"));
+    EXPECT_TRUE(SOH3.findObjectCached("test1"));
+    SOH3.removeObject("test1");
+    EXPECT_EQ(freed.load(), 2);
+}
+
+TEST(SOH, visitors)
+{
+    for (auto mode : {HolderMode::locking, HolderMode::snapshot}) {
+        SearchableObjectHolder<std::string, char> SOH1(mode);
+        SOH1.addObject("b", std::make_shared<std::string>("bb"), 'x');
+        SOH1.addObject("a", std::make_shared<std::string>("a"), 'y');
+        SOH1.addObject("c", std::make_shared<std::string>("ccc"), 'x');
+        std::size_t length{0};
+        EXPECT_TRUE(SOH1.withObject(
+            "c", [&length](const std::string& obj) { length = obj.size(); }));
+        EXPECT_EQ(length, 3U);
+        EXPECT_FALSE(
+            SOH1.withObject("d", [](const std::string& /*obj*/) { FAIL(); }));
+
+        std::string names;
+        SOH1.forEach([&names](const std::string& name, const std::string& obj) {
+            names += name + "=" + obj + ";";
+        });
+        EXPECT_EQ(names, "a=a;b=bb;c=ccc;");
+        names.clear();
+        SOH1.forEachOfType('x',
+                           [&names](const std::string& name,
+                                    const std::string& /*obj*/) {
+                               names += name;
+                           });
+        EXPECT_EQ(names, "bc");
+        SOH1.removeObject("a");
+        SOH1.removeObject("b");
+        SOH1.removeObject("c");
+    }
+}
+
+TEST(SOH, waitForObject)
+{
+    SearchableObjectHolder<std::string> SOH1;
+    EXPECT_FALSE(SOH1.waitForObject("peer", std::chrono::milliseconds(5)));
+    std::string seen;
+    EXPECT_NE(SOH1.onObjectAdded(
+                  "copy",
+                  [&seen](const std::shared_ptr<std::string>& obj) {
+                      seen = *obj;
+                  }),
+              0U);
+    std::thread registrar([&SOH1]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        SOH1.addObject("peer", std::make_shared<std::string>("peer_1"));
+        SOH1.copyObject("peer", "copy");
+    });
+    auto obj = SOH1.waitForObject("peer", std::chrono::seconds(5));
+    registrar.join();
+    ASSERT_TRUE(obj);
+    EXPECT_EQ(*obj, "peer_1");
+    EXPECT_EQ(seen, "peer_1");
+    // existing objects are delivered immediately
+    int calls{0};
+    EXPECT_EQ(SOH1.onObjectAdded(
+                  "peer",
+                  [&calls](const std::shared_ptr<std::string>& /*obj*/) {
+                      ++calls;
+                  }),
+              0U);
+    EXPECT_EQ(calls, 1);
+    // a cancelled callback is never called
+    auto id = SOH1.onObjectAdded(
+        "later", [&calls](const std::shared_ptr<std::string>& /*obj*/) {
+            ++calls;
+        });
+    EXPECT_TRUE(SOH1.cancelObjectAdded("later", id));
+    EXPECT_FALSE(SOH1.cancelObjectAdded("later", id));
+    SOH1.addObject("later", std::make_shared<std::string>("later_1"));
+    EXPECT_EQ(calls, 1);
+    SOH1.removeObject("later");
+    SOH1.removeObject("peer");
+    SOH1.removeObject("copy");
+    SOH1.addObject("copy", std::make_shared<std::string>("again"));
+    EXPECT_EQ(seen, "peer_1");
+    SOH1.removeObject("copy");
+}
+
+TEST(SOH, sharded)
+{
+    for (auto mode : {HolderMode::locking, HolderMode::snapshot}) {
+        SearchableObjectHolder<std::string, char> SOH1(mode, 8);
+        EXPECT_EQ(SOH1.shardCount(), 8U);
+        std::vector<std::thread> writers;
+        for (int jj = 0; jj < 4; ++jj) {
+            writers.emplace_back([&SOH1, jj]() {
+                for (int ii = jj; ii < 400; ii += 4) {
+                    SOH1.addObject(
+                        "obj" + std::to_string(ii),
+                        std::make_shared<std::string>(std::to_string(ii)),
+                        static_cast<char>('a' + ii % 2));
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        EXPECT_EQ(SOH1.getObjects().size(), 400U);
+        EXPECT_EQ(SOH1.getObjectsOfType('a').size(), 200U);
+        EXPECT_EQ(*SOH1.findObject("obj17"), "17");
+        EXPECT_TRUE(SOH1.checkObjectType("obj17", 'b'));
+
+        // copies between shards keep the object and its types
+        for (int ii = 0; ii < 20; ++ii) {
+            EXPECT_TRUE(SOH1.copyObject("obj" + std::to_string(ii),
+                                        "copy" + std::to_string(ii)));
+            EXPECT_EQ(SOH1.findObject("copy" + std::to_string(ii)),
+                      SOH1.findObject("obj" + std::to_string(ii)));
+        }
+        EXPECT_TRUE(SOH1.checkObjectType("copy17", 'b'));
+        EXPECT_FALSE(SOH1.copyObject("missing", "copy100"));
+        EXPECT_FALSE(SOH1.copyObject("obj1", "obj2"));
+
+        auto is123 = [](const std::shared_ptr<std::string>& obj) {
+            return *obj == "123";
+        };
+        EXPECT_TRUE(SOH1.findObject(is123));
+        EXPECT_TRUE(SOH1.findObject(is123, 'b'));
+        EXPECT_FALSE(SOH1.findObject(is123, 'a'));
+
+        auto handle = SOH1.getHandle("obj250");
+        ASSERT_TRUE(handle.isValid());
+        EXPECT_EQ(*SOH1.findObject(handle), "250");
+        std::size_t count{0};
+        SOH1.forEach([&count](const std::string& /*name*/,
+                              const std::string& /*obj*/) { ++count; });
+        EXPECT_EQ(count, 420U);
+
+        EXPECT_TRUE(SOH1.removeObject(is123));
+        EXPECT_FALSE(SOH1.findObject("obj123"));
+        for (int ii = 0; ii < 400; ++ii) {
+            SOH1.removeObject("obj" + std::to_string(ii));
+        }
+        for (int ii = 0; ii < 20; ++ii) {
+            SOH1.removeObject("copy" + std::to_string(ii));
+        }
+        EXPECT_TRUE(SOH1.empty());
+        EXPECT_FALSE(SOH1.findObject(handle));
+    }
+}
+
+TEST(SOH, bulk)
+{
+    for (std::size_t shardCount : {1U, 4U}) {
+        SearchableObjectHolder<std::string> SOH1(HolderMode::locking,
+                                                 shardCount);
+        SOH1.addObject("obj5", std::make_shared<std::string>("existing"));
+        std::vector<std::pair<std::string, std::shared_ptr<std::string>>>
+            objects;
+        for (int ii = 0; ii < 10; ++ii) {
+            objects.emplace_back(
+                "obj" + std::to_string(ii),
+                std::make_shared<std::string>(std::to_string(ii)));
+        }
+        // a duplicate within the batch is rejected as well
+        objects.emplace_back("obj2", std::make_shared<std::string>("dup"));
+        auto results = SOH1.addObjects(objects);
+        ASSERT_EQ(results.size(), 11U);
+        for (int ii = 0; ii < 10; ++ii) {
+            EXPECT_EQ(results[ii], ii != 5);
+        }
+        EXPECT_FALSE(results[10]);
+        EXPECT_EQ(*SOH1.findObject("obj5"), "existing");
+        EXPECT_EQ(*SOH1.findObject("obj2"), "2");
+        EXPECT_EQ(SOH1.getObjects().size(), 10U);
+        auto handle = SOH1.getHandle("obj7");
+        EXPECT_EQ(*SOH1.findObject(handle), "7");
+
+        std::vector<std::string> names{"obj1", "missing", "obj7", "obj1"};
+        auto removed = SOH1.removeObjects(names);
+        EXPECT_EQ(removed, (std::vector<bool>{true, false, true, false}));
+        EXPECT_FALSE(SOH1.findObject("obj1"));
+        EXPECT_FALSE(SOH1.findObject(handle));
+        EXPECT_EQ(SOH1.getObjects().size(), 8U);
+        std::vector<std::string> all;
+        for (int ii = 0; ii < 10; ++ii) {
+            all.push_back("obj" + std::to_string(ii));
+        }
+        SOH1.removeObjects(all);
+        EXPECT_TRUE(SOH1.empty());
+
+        // names that are not std::string are converted
+        std::vector<std::pair<const char*, std::shared_ptr<std::string>>>
+            literals{{"lit1", std::make_shared<std::string>("1")},
+                     {"lit2", std::make_shared<std::string>("2")}};
+        EXPECT_EQ(SOH1.addObjects(literals), (std::vector<bool>{true, true}));
+        EXPECT_EQ(*SOH1.findObject("lit2"), "2");
+        EXPECT_EQ(SOH1.removeObjects(
+                      std::vector<const char*>{"lit1", "missing", "lit2"}),
+                  (std::vector<bool>{true, false, true}));
+        EXPECT_TRUE(SOH1.empty());
+    }
+}
+
+TEST(SOH, parallelSearch)
+{
+    for (std::size_t shardCount : {1U, 4U}) {
+        SearchableObjectHolder<int> SOH1(
+            (shardCount == 1) ? HolderMode::locking : HolderMode::snapshot,
+            shardCount);
+        for (int ii = 0; ii < 100; ++ii) {
+            SOH1.addObject("obj" + std::to_string(ii),
+                           std::make_shared<int>(ii));
+        }
+        auto isMatch = [](const std::shared_ptr<int>& val) {
+            return *val > 40 && *val % 7 == 0;
+        };
+        auto serial = SOH1.findObject(isMatch);
+        ASSERT_TRUE(serial);
+        EXPECT_EQ(SOH1.findObjectParallel(isMatch, 4), serial);
+        EXPECT_EQ(SOH1.findObjectParallel(isMatch, 1), serial);
+        EXPECT_FALSE(SOH1.findObjectParallel(
+            [](const std::shared_ptr<int>& val) { return *val > 100; }, 4));
+
+        std::vector<std::thread> threads;
+        std::atomic<int> submitted{0};
+        auto executor = [&threads, &submitted](std::function<void()> task) {
+            ++submitted;
+            threads.emplace_back(std::move(task));
+        };
+        auto matches = SOH1.findObjects(isMatch, 3, executor);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(submitted.load(), 2);
+        EXPECT_EQ(matches.size(), 9U);
+        EXPECT_EQ(matches, SOH1.findObjects(isMatch));
+        EXPECT_EQ(matches.front(), serial);
+
+        EXPECT_THROW(SOH1.findObjects(
+                         [](const std::shared_ptr<int>& val) -> bool {
+                             if (*val == 50) {
+                                 throw std::runtime_error("bad value");
+                             }
+                             return false;
+                         },
+                         4),
+                     std::runtime_error);
+        for (int ii = 0; ii < 100; ++ii) {
+            SOH1.removeObject("obj" + std::to_string(ii));
+        }
+    }
+}
+
+TEST(SOH, prefixQueries)
+{
+    for (auto mode : {HolderMode::locking, HolderMode::snapshot}) {
+        for (std::size_t shardCount : {1U, 4U}) {
+            SearchableObjectHolder<std::string> SOH1(mode, shardCount);
+            for (const char* name : {"fed1/sub1/pub1",
+                                     "fed1/sub1/pub2",
+                                     "fed1/sub2/pub1",
+                                     "fed10/sub1/pub1",
+                                     "fed2/sub1/pub1",
+                                     "fed1"}) {
+                SOH1.addObject(name, std::make_shared<std::string>(name));
+            }
+            auto handle = SOH1.getHandle("fed1/sub2/pub1");
+            EXPECT_EQ(SOH1.findObjectsWithPrefix("fed1/").size(), 3U);
+            EXPECT_EQ(SOH1.findObjectsWithPrefix("fed1").size(), 5U);
+            auto sub1 = SOH1.findObjectsWithPrefix("fed1/sub1/");
+            ASSERT_EQ(sub1.size(), 2U);
+            if (shardCount == 1) {
+                EXPECT_EQ(*sub1[0], "fed1/sub1/pub1");
+                EXPECT_EQ(*sub1[1], "fed1/sub1/pub2");
+            }
+            EXPECT_TRUE(SOH1.findObjectsWithPrefix("fed3").empty());
+            EXPECT_EQ(SOH1.findObjectsWithPrefix("").size(), 6U);
+
+            EXPECT_EQ(SOH1.removeObjectsWithPrefix("fed3"), 0U);
+            EXPECT_EQ(SOH1.removeObjectsWithPrefix("fed1/"), 3U);
+            EXPECT_FALSE(SOH1.findObject(handle));
+            EXPECT_TRUE(SOH1.findObject("fed1"));
+            EXPECT_TRUE(SOH1.findObject("fed10/sub1/pub1"));
+            EXPECT_EQ(SOH1.getObjects().size(), 3U);
+            EXPECT_EQ(SOH1.removeObjectsWithPrefix(""), 3U);
+            EXPECT_TRUE(SOH1.empty());
+        }
+    }
+}